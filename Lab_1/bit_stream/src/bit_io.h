@@ -0,0 +1,468 @@
+//-------------------------------------------------------------------------------------------
+//
+// Copyright 2025 University of Aveiro, Portugal, All Rights Reserved.
+//
+// These programs are supplied free of charge for research purposes only,
+// and may not be sold or incorporated into any commercial product. There is
+// ABSOLUTELY NO WARRANTY of any sort, nor any undertaking that they are
+// fit for ANY PURPOSE WHATSOEVER. Use them at your own risk. If you do
+// happen to find a bug, or have modifications to suggest, please report
+// the same to Armando J. Pinho, ap@ua.pt. The copyright notice above
+// and this statement of conditions must remain an integral part of each
+// and every copy made of these files.
+//
+// Armando J. Pinho (ap@ua.pt)
+// IEETA / DETI / University of Aveiro
+//
+//-------------------------------------------------------------------------------------------
+
+#ifndef BIT_IO_H
+#define BIT_IO_H
+
+//
+// Header-only bit writer and reader, templated on the byte endpoint so the
+// whole bit path inlines into the coders that use it.
+//
+// A Sink provides:   put(int c), put_word(uint64_t w), tell(), close()
+// A Source provides: data(), available(), skip(size_t n), fill(), tell(),
+//                    seek(off_t pos), close(), with BIT_IO_PAD loadable
+//                    bytes at data()
+//
+// ByteStream is both (file, mmap, fd, vector and span endpoints);
+// CountingSink only measures the output size.
+//
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <span>
+#include <sys/types.h>
+#include "bit_pack.h"
+
+const int BIT_IO_PAD = 8;
+
+inline uint64_t load_be64(const uint8_t* p) {
+	uint64_t w;
+	memcpy(&w, p, sizeof w);
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	w = __builtin_bswap64(w);
+#endif
+	return w;
+}
+
+//-------------------------------------------------------------------------------------------
+
+class CountingSink {
+  private:
+	off_t	m_tell { };
+
+  public:
+	void put(int) { m_tell++; }
+	void put_word(uint64_t) { m_tell += 8; }
+	off_t tell() { return m_tell; }
+	void close() { }
+};
+
+//-------------------------------------------------------------------------------------------
+
+template<class Sink>
+class BasicBitWriter {
+  private:
+	Sink&		m_sink;
+	uint64_t	m_acc { };		// Write accumulator, filled from the MSB side
+	int			m_acc_bits { };	// Number of bits currently held in m_acc
+
+  public:
+	explicit BasicBitWriter(Sink& sink) : m_sink { sink } { }
+
+	BasicBitWriter(const BasicBitWriter&) = delete;
+	BasicBitWriter& operator=(const BasicBitWriter&) = delete;
+
+	void write_bit(int bit) { write_n_bits(bit & 0x01, 1); }
+	void write_n_bits(uint64_t bits, int n);
+	void write_string(const std::string& s);
+	void write_bytes(std::span<const uint8_t> bytes, uint64_t n_bits);
+	void pack_fixed(const uint32_t* v, size_t n, int width);
+	off_t tell() { return m_sink.tell() + m_acc_bits / 8; }
+	uint64_t tell_bits() { return uint64_t(m_sink.tell()) * 8 + m_acc_bits; }
+	void close();
+};
+
+//
+// Appends the n (0 <= n <= 64) least significant bits of "bits", most
+// significant first, to the 64-bit accumulator. Whenever the accumulator
+// fills up, the whole word is handed to the sink at once.
+//
+template<class Sink>
+inline void BasicBitWriter<Sink>::write_n_bits(uint64_t bits, int n) {
+	if(n == 0)
+		return;
+
+	if(n < 64)
+		bits &= (uint64_t { 1 } << n) - 1;
+
+	int free_bits = 64 - m_acc_bits;
+	if(n < free_bits) {
+		m_acc |= bits << (free_bits - n);
+		m_acc_bits += n;
+		return;
+	}
+
+	// The word is complete: emit it and keep the bits that did not fit
+	m_acc |= bits >> (n - free_bits);
+	m_sink.put_word(m_acc);
+	m_acc_bits = n - free_bits;
+	m_acc = m_acc_bits == 0 ? 0 : bits << (64 - m_acc_bits);
+}
+
+template<class Sink>
+inline void BasicBitWriter<Sink>::write_string(const std::string& s) {
+	for(const char c : s)
+		write_n_bits(c, 8);
+
+	write_n_bits('\n', 8); // Mark the end of the string with a newline
+}
+
+//
+// Splices the first n_bits of a buffer (typically the output of a memory
+// stream) into this stream, 56 bits per call where possible.
+//
+template<class Sink>
+inline void BasicBitWriter<Sink>::write_bytes(std::span<const uint8_t> bytes, uint64_t n_bits) {
+	size_t i { };
+
+	for( ; n_bits >= 56 and bytes.size() - i >= 8 ; i += 7, n_bits -= 56)
+		write_n_bits(load_be64(&bytes[i]) >> 8, 56);
+
+	for( ; n_bits >= 8 ; i++, n_bits -= 8)
+		write_n_bits(bytes[i], 8);
+
+	if(n_bits > 0)
+		write_n_bits(bytes[i] >> (8 - n_bits), n_bits);
+}
+
+//
+// Writes n values of a constant width (1 <= width <= 32), keeping the low
+// width bits of each. Equivalent to write_n_bits(v[i], width) for each value,
+// but eight (SIMD) or two (scalar) values are merged per accumulator update.
+//
+template<class Sink>
+inline void BasicBitWriter<Sink>::pack_fixed(const uint32_t* v, size_t n, int width) {
+	size_t i { };
+
+#ifdef BIT_IO_AVX2
+	if(width <= 16 and bit_io_has_avx2()) {
+		uint64_t chunks[128];
+
+		while(n - i >= 8) {
+			size_t groups = (n - i) / 8 < 64 ? (n - i) / 8 : 64;
+			pack8_avx2(v + i, groups, width, chunks);
+
+			for(size_t g = 0 ; g < 2 * groups ; g++)
+				write_n_bits(chunks[g], 4 * width);
+
+			i += 8 * groups;
+		}
+	}
+#endif
+
+	uint64_t mask = (uint64_t { 1 } << width) - 1;
+	for( ; n - i >= 2 ; i += 2)
+		write_n_bits(((v[i] & mask) << width) | (v[i + 1] & mask), 2 * width);
+
+	if(i < n)
+		write_n_bits(v[i], width);
+}
+
+template<class Sink>
+inline void BasicBitWriter<Sink>::close() {
+	// Flush the accumulator, padding the last byte with zeros
+	for(int s = 56 ; m_acc_bits > 0 ; s -= 8, m_acc_bits -= 8)
+		m_sink.put((m_acc >> s) & 0xff);
+
+	m_acc = 0;
+	m_acc_bits = 0;
+	m_sink.close();
+}
+
+//-------------------------------------------------------------------------------------------
+
+template<class Source>
+class BasicBitReader {
+  private:
+	Source&		m_src;
+	uint64_t	m_cache { };		// Read cache, next bit in the MSB
+	int			m_cache_bits { };	// Number of valid bits in m_cache
+
+	bool refill();
+
+  public:
+	explicit BasicBitReader(Source& src) : m_src { src } { }
+
+	BasicBitReader(const BasicBitReader&) = delete;
+	BasicBitReader& operator=(const BasicBitReader&) = delete;
+
+	// peek_bits, skip_bits and read_bits take 0 <= n <= 56 bits. peek_bits
+	// pads with zeros past the end of the stream; skip_bits returns false and
+	// read_bits all ones (EOF when cast to int) if the stream ends before n bits.
+	uint64_t peek_bits(int n);
+	bool skip_bits(int n);
+	uint64_t read_bits(int n);
+	int read_unary();
+	bool eof();
+
+	int read_bit();
+	uint64_t read_n_bits(int n);
+	std::string read_string();
+	size_t read_bytes(std::span<uint8_t> bytes);
+	size_t unpack_fixed(uint32_t* v, size_t n, int width);
+
+	// Bytes touched by the reader, including a partially read one
+	off_t tell() { return m_src.tell() - m_cache_bits / 8; }
+	uint64_t tell_bits() { return uint64_t(m_src.tell()) * 8 - m_cache_bits; }
+	bool seek_bits(uint64_t offset);
+	void close() { m_src.close(); }
+};
+
+//
+// Tops up the read cache with one unaligned 8-byte load. Bits of the loaded
+// word beyond the bytes accounted for are the next bytes of the stream (or
+// zero padding), so OR-ing them in again on the next refill is harmless.
+// Returns false only when the stream is exhausted.
+//
+template<class Source>
+inline bool BasicBitReader<Source>::refill() {
+	size_t avail = m_src.available();
+	if(avail == 0) {
+		if(not m_src.fill())
+			return false;
+
+		avail = m_src.available();
+	}
+
+	m_cache |= load_be64(m_src.data()) >> m_cache_bits;
+
+	size_t n = (63 - m_cache_bits) >> 3;
+	n = n < avail ? n : avail;
+	m_src.skip(n);
+	m_cache_bits += 8 * n;
+
+	return true;
+}
+
+template<class Source>
+inline uint64_t BasicBitReader<Source>::peek_bits(int n) {
+	while(m_cache_bits < n and refill())
+		;
+
+	return n == 0 ? 0 : m_cache >> (64 - n);
+}
+
+template<class Source>
+inline bool BasicBitReader<Source>::skip_bits(int n) {
+	while(m_cache_bits < n and refill())
+		;
+
+	if(n >= m_cache_bits) { // Also covers skipping past the end
+		bool whole = n == m_cache_bits;
+		m_cache = 0;
+		m_cache_bits = 0;
+		return whole;
+	}
+
+	m_cache <<= n;
+	m_cache_bits -= n;
+	return true;
+}
+
+template<class Source>
+inline uint64_t BasicBitReader<Source>::read_bits(int n) {
+	while(m_cache_bits < n) {
+		if(not refill()) {
+			m_cache = 0;
+			m_cache_bits = 0;
+			return ~uint64_t { 0 };
+		}
+	}
+
+	if(n == 0)
+		return 0;
+
+	uint64_t x = m_cache >> (64 - n);
+	m_cache <<= n;
+	m_cache_bits -= n;
+
+	return x;
+}
+
+//
+// Reads a run of 1 bits and its terminating 0, returning the run length.
+// Each step counts the leading ones of the whole cache with one clz, so a
+// long run costs one step per cached word. Returns EOF if the stream ends
+// before the terminating 0.
+//
+template<class Source>
+inline int BasicBitReader<Source>::read_unary() {
+	int q { };
+
+	for(;;) {
+		if(m_cache_bits < 56 and not refill() and m_cache_bits == 0)
+			return EOF;
+
+		uint64_t zeros = ~m_cache;
+		int run = zeros == 0 ? 64 : __builtin_clzll(zeros);
+		if(run < m_cache_bits) { // The terminating 0 is in the cache
+			m_cache = (m_cache << run) << 1;
+			m_cache_bits -= run + 1;
+			return q + run;
+		}
+
+		// Every cached bit is a 1: take them all and go on
+		q += m_cache_bits;
+		m_cache = 0;
+		m_cache_bits = 0;
+	}
+}
+
+//
+// Repositions the reader at an absolute bit offset, as returned by
+// tell_bits() on the writer or the reader. Returns false if the source
+// cannot seek there (e.g. a pipe).
+//
+template<class Source>
+inline bool BasicBitReader<Source>::seek_bits(uint64_t offset) {
+	m_cache = 0;
+	m_cache_bits = 0;
+
+	if(not m_src.seek(offset / 8))
+		return false;
+
+	skip_bits(offset % 8);
+	return true;
+}
+
+template<class Source>
+inline bool BasicBitReader<Source>::eof() {
+	return m_cache_bits == 0 and not refill();
+}
+
+template<class Source>
+inline int BasicBitReader<Source>::read_bit() {
+	if(m_cache_bits == 0 and not refill())
+		return EOF;
+
+	int bit = m_cache >> 63;
+	m_cache <<= 1;
+	m_cache_bits--;
+
+	return bit;
+}
+
+template<class Source>
+inline uint64_t BasicBitReader<Source>::read_n_bits(int n) {
+	if(n <= 56)
+		return read_bits(n);
+
+	uint64_t hi = read_bits(n - 32);
+	uint64_t lo = read_bits(32);
+	if(hi == ~uint64_t { 0 } or lo == ~uint64_t { 0 })
+		return ~uint64_t { 0 };
+
+	return (hi << 32) | lo;
+}
+
+//
+// Reads up to n values of a constant width (1 <= width <= 32), as written by
+// pack_fixed(). Returns how many whole values were read before the end of the
+// stream. With SIMD, groups of eight values are unpacked straight from the
+// source buffer: the values left in the cache are taken first, and one
+// value may straddle the cache and the buffer.
+//
+template<class Source>
+inline size_t BasicBitReader<Source>::unpack_fixed(uint32_t* v, size_t n, int width) {
+	size_t i { };
+
+	while(i < n) {
+#ifdef BIT_IO_AVX2
+		if(width <= 16 and n - i >= 16 and m_src.available() >= 64 and bit_io_has_avx2()) {
+			for( ; i < n and m_cache_bits >= width ; i++) {
+				v[i] = m_cache >> (64 - width);
+				m_cache <<= width;
+				m_cache_bits -= width;
+			}
+
+			if(n - i < 16)
+				continue;
+
+			const uint8_t* p = m_src.data();
+			size_t bit { };
+			if(m_cache_bits > 0) {
+				bit = width - m_cache_bits;
+				v[i++] = ((m_cache >> (64 - m_cache_bits)) << bit) | (load_be64(p) >> (64 - bit));
+			}
+
+			m_cache = 0;
+			m_cache_bits = 0;
+
+			size_t groups = unpack8_avx2(p + bit / 8, m_src.available() - bit / 8, bit % 8, width, v + i,
+			  (n - i) / 8);
+			i += 8 * groups;
+			bit += 8 * groups * width;
+
+			m_src.skip(bit / 8);
+			skip_bits(bit % 8);
+			continue;
+		}
+#endif
+
+		uint64_t x = read_bits(width);
+		if(x == ~uint64_t { 0 })
+			break;
+
+		v[i++] = x;
+	}
+
+	return i;
+}
+
+template<class Source>
+inline std::string BasicBitReader<Source>::read_string() {
+	int c;
+	std::string s;
+
+	while((c = read_n_bits(8)) != '\n')
+		s += c;
+
+	return s;
+}
+
+//
+// Reads bytes.size() bytes from the current bit position, 56 bits per call
+// where possible. Returns the number of bytes read, fewer if the stream ends.
+//
+template<class Source>
+inline size_t BasicBitReader<Source>::read_bytes(std::span<uint8_t> bytes) {
+	size_t i { };
+
+	for( ; bytes.size() - i >= 7 ; i += 7) {
+		uint64_t x = read_bits(56);
+		if(x == ~uint64_t { 0 })
+			return i;
+
+		for(int k = 0 ; k < 7 ; k++)
+			bytes[i + k] = x >> (48 - 8 * k);
+	}
+
+	for( ; i < bytes.size() ; i++) {
+		uint64_t x = read_bits(8);
+		if(x == ~uint64_t { 0 })
+			return i;
+
+		bytes[i] = x;
+	}
+
+	return i;
+}
+
+#endif
@@ -21,33 +21,61 @@
 
 #include <string>
 #include <fstream>
+#include <vector>
+#include <span>
+#include <cstdint>
+#include <utility>
+#include "bit_io.h"
 #include "byte_stream.h"
 
-class BitStream {
+static_assert(BYTE_STREAM_BUF_PAD >= BIT_IO_PAD, "ByteStream padding too small for BasicBitReader");
+
+//
+// Bit stream over one byte stream, opened either for reading or for writing.
+// The constructor arguments are those of the underlying stream, e.g.
+// (std::fstream&, rw_status), a path (read), a std::vector<uint8_t>& (write)
+// or a std::span<const uint8_t> (read). Readers can also seek_bits().
+//
+template<class Stream>
+class BasicBitStream : public BasicBitWriter<Stream>, public BasicBitReader<Stream> {
   private:
-	bool		m_rw_status { STREAM_READ };
-	int			m_buf;
-	int			m_bit_ptr;
-	ByteStream	m_byte_stream;
+	Stream		m_stream;
 
   public:
-	BitStream(std::fstream& fs, bool rw_status);
-
-	BitStream() = delete;
-	BitStream(const BitStream&) = delete;
-	BitStream(BitStream&&) = delete;
-	BitStream& operator=(BitStream&&) = delete;
-	BitStream& operator=(const BitStream&) = delete;
-
-	int read_bit();
-	uint64_t read_n_bits(int n);
-	std::string read_string();
-	void write_bit(int bit);
-	void write_n_bits(uint64_t bits, int n);
-	void write_string(const std::string& s);
-	off_t tell();
-	void close();
+	template<class... Args>
+	explicit BasicBitStream(Args&&... args) : BasicBitWriter<Stream> { m_stream },
+	  BasicBitReader<Stream> { m_stream }, m_stream { std::forward<Args>(args)... } { }
+
+	BasicBitStream(const BasicBitStream&) = delete;
+	BasicBitStream(BasicBitStream&&) = delete;
+	BasicBitStream& operator=(BasicBitStream&&) = delete;
+	BasicBitStream& operator=(const BasicBitStream&) = delete;
+
+	bool is_open() { return m_stream.is_open(); }
+	std::span<const uint8_t> mapped() { return m_stream.mapped(); }
+
+	off_t tell() {
+		if(m_stream.rw_status() == STREAM_WRITE)
+			return BasicBitWriter<Stream>::tell();
+
+		return BasicBitReader<Stream>::tell();
+	}
+
+	uint64_t tell_bits() {
+		if(m_stream.rw_status() == STREAM_WRITE)
+			return BasicBitWriter<Stream>::tell_bits();
+
+		return BasicBitReader<Stream>::tell_bits();
+	}
+
+	void close() {
+		if(m_stream.rw_status() == STREAM_WRITE)
+			BasicBitWriter<Stream>::close(); // Flushes the pending bits
+		else
+			BasicBitReader<Stream>::close();
+	}
 };
 
-#endif
+using BitStream = BasicBitStream<ByteStream>;
 
+#endif
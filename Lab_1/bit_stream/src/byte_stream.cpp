@@ -16,55 +16,210 @@
 //
 //-------------------------------------------------------------------------------------------
 
+#include <cerrno>
+#include <cstring>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include "byte_stream.h"
 
 using namespace std;
 
 //-------------------------------------------------------------------------------------------
+//
+// Ring of write buffers shared with the background writer thread. Buffers
+// go from "free" to the caller, then to "full" and back to "free" once
+// written; "full" is a FIFO so the file receives them in order.
+//
+struct AsyncWriteQueue {
+	vector<unique_ptr<uint8_t[]>>	bufs;
+	deque<pair<uint8_t*, size_t>>	full;
+	vector<uint8_t*>				free;
+	mutex							mtx;
+	condition_variable				cv;
+	bool							stop { };
+	bool							failed { };
+	thread							writer;
+};
 
-ByteStream::ByteStream(fstream& fs, bool rw_status) : m_rw_status { rw_status }, m_fs { fs } {
-	m_buf_limit = m_buf + BYTE_STREAM_BUF_SIZE;
-	if(m_rw_status) { // Open for reading
-		m_buf_ptr = m_buf_limit;
-		m_size = BYTE_STREAM_BUF_SIZE;
+//-------------------------------------------------------------------------------------------
+
+ByteStream::ByteStream(fstream& fs, bool rw_status, int async_buffers) : m_rw_status { rw_status },
+  m_fs { &fs } {
+	if(m_rw_status) { // Open for reading: empty buffer, filled on first access
+		m_buf_start = m_buf_ptr = m_buf_limit = m_buf;
+		memset(m_buf, 0, BYTE_STREAM_BUF_PAD);
 	}
 
-	else // Open for writing
-		m_buf_ptr = m_buf;
+	else { // Open for writing
+		m_buf_start = m_buf_ptr = m_buf;
+		m_buf_limit = m_buf + BYTE_STREAM_BUF_SIZE;
+
+		if(async_buffers >= 2) {
+			m_async = make_unique<AsyncWriteQueue>();
+			for(int i = 0 ; i < async_buffers ; i++) {
+				m_async->bufs.emplace_back(new uint8_t[BYTE_STREAM_BUF_SIZE]);
+				m_async->free.push_back(m_async->bufs.back().get());
+			}
+
+			m_buf_start = m_buf_ptr = m_async->free.back();
+			m_buf_limit = m_buf_start + BYTE_STREAM_BUF_SIZE;
+			m_async->free.pop_back();
+			m_async->writer = thread { &ByteStream::async_loop, this };
+		}
+	}
 }
 
 //---------------------------------------------------------------------------------
 //
-// m_buf_ptr points to the next free buffer position
+// Regular files are memory-mapped and read in place, without going through
+// m_buf. Anything that cannot be mapped (pipes, terminals, empty files) is
+// read with read(2) into m_buf instead.
 //
-void ByteStream::put(int c) {
-	*m_buf_ptr++ = c;
-	m_tell++;
+ByteStream::ByteStream(const string& path) : m_rw_status { STREAM_READ } {
+	m_buf_start = m_buf_ptr = m_buf_limit = m_buf;
+	memset(m_buf, 0, BYTE_STREAM_BUF_PAD);
 
-	if(m_buf_ptr == m_buf_limit) { // buffer is full: write it
-		m_fs.write((char*)m_buf, BYTE_STREAM_BUF_SIZE);
-		m_buf_ptr = m_buf;
+	m_fd = path == "-" ? dup(STDIN_FILENO) : open(path.c_str(), O_RDONLY);
+	if(m_fd < 0)
+		return;
+
+	struct stat st;
+	if(fstat(m_fd, &st) != 0 or not S_ISREG(st.st_mode) or st.st_size == 0)
+		return;
+
+	void* map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, m_fd, 0);
+	if(map == MAP_FAILED)
+		return;
+
+	madvise(map, st.st_size, MADV_SEQUENTIAL);
+	m_map = (uint8_t*)map;
+	m_map_size = st.st_size;
+	m_mapped = true;
+
+	::close(m_fd); // The mapping stays valid
+	m_fd = -1;
+}
+
+//---------------------------------------------------------------------------------
+//
+// Memory endpoints use the same buffer as files: a sink appends m_buf to the
+// vector whenever it is flushed, and a source is read in place like a mapping.
+//
+ByteStream::ByteStream(vector<uint8_t>& out) : m_rw_status { STREAM_WRITE }, m_vec { &out } {
+	m_buf_start = m_buf_ptr = m_buf;
+	m_buf_limit = m_buf + BYTE_STREAM_BUF_SIZE;
+}
+
+ByteStream::ByteStream(span<const uint8_t> in) : m_rw_status { STREAM_READ } {
+	m_buf_start = m_buf_ptr = m_buf_limit = m_buf;
+	memset(m_buf, 0, BYTE_STREAM_BUF_PAD);
+
+	m_map = const_cast<uint8_t*>(in.data()); // Never written through
+	m_map_size = in.size();
+}
+
+//---------------------------------------------------------------------------------
+
+ByteStream::~ByteStream() {
+	stop_async();
+	release();
+}
+
+//---------------------------------------------------------------------------------
+//
+// put_word() when the word does not fit in what is left of the buffer
+//
+void ByteStream::put_word_slow(uint64_t w) {
+	for(int s = 56 ; s >= 0 ; s -= 8)
+		put((w >> s) & 0xff);
+}
+
+//---------------------------------------------------------------------------------
+//
+// Replaces the (fully consumed) buffer with the next block of the file and
+// zeroes the padding after it. Returns false at end of file.
+//
+bool ByteStream::fill() {
+	if(m_map != nullptr)
+		return fill_from_map();
+
+	ssize_t n { };
+	if(m_fs != nullptr) {
+		m_fs->read((char*)m_buf, BYTE_STREAM_BUF_SIZE);
+		n = m_fs->gcount();
+	} else if(m_fd >= 0) {
+		while((n = read(m_fd, m_buf, BYTE_STREAM_BUF_SIZE)) < 0 and errno == EINTR)
+			;
+
+		if(n < 0)
+			n = 0;
 	}
+
+	m_buf_ptr = m_buf;
+	m_buf_limit = m_buf + n;
+	memset(m_buf_limit, 0, BYTE_STREAM_BUF_PAD);
+
+	return n != 0;
 }
 
 //---------------------------------------------------------------------------------
 //
-// m_buf_ptr points to the next buffer char
+// The first block is the whole mapping except its last BYTE_STREAM_BUF_PAD
+// bytes, so that word loads never run past the end of the mapping. Those
+// last bytes are then copied into the padded m_buf as a final block.
 //
-int ByteStream::get() {
-	if(m_buf_ptr == m_buf_limit) { // buffer is empty: get another block
-		m_fs.read((char*)m_buf, BYTE_STREAM_BUF_SIZE);
-		if((m_size = m_fs.gcount()) == 0)
-			return EOF;
+bool ByteStream::fill_from_map() {
+	size_t left = m_map_size - m_map_pos;
 
-		m_buf_ptr = m_buf;
+	if(left > BYTE_STREAM_BUF_PAD) {
+		m_buf_ptr = m_map + m_map_pos;
+		m_buf_limit = m_map + m_map_size - BYTE_STREAM_BUF_PAD;
 	} else {
-		if(m_buf_ptr - m_buf == m_size)
-			return EOF;
+		memcpy(m_buf, m_map + m_map_pos, left);
+		m_buf_ptr = m_buf;
+		m_buf_limit = m_buf + left;
+		memset(m_buf_limit, 0, BYTE_STREAM_BUF_PAD);
 	}
 
-	m_tell++;
-	return *m_buf_ptr++;
+	m_map_pos += m_buf_limit - m_buf_ptr;
+
+	return left != 0;
+}
+
+//---------------------------------------------------------------------------------
+//
+// Moves the read position to byte pos. Mapped and memory inputs just restart
+// their block there; files are repositioned and refilled on the next access.
+// Returns false if the input cannot seek (pipes) or pos is past its end.
+//
+bool ByteStream::seek(off_t pos) {
+	if(not m_rw_status or pos < 0)
+		return false;
+
+	if(m_map != nullptr) {
+		if((size_t)pos > m_map_size)
+			return false;
+
+		m_map_pos = pos;
+	} else if(m_fs != nullptr) {
+		m_fs->clear();
+		if(not m_fs->seekg(pos))
+			return false;
+	} else if(m_fd < 0 or lseek(m_fd, pos, SEEK_SET) != pos)
+		return false;
+
+	m_buf_ptr = m_buf_limit = m_buf; // Empty: the next access refills
+	memset(m_buf, 0, BYTE_STREAM_BUF_PAD);
+	m_tell = pos;
+
+	return true;
 }
 
 //---------------------------------------------------------------------------------
@@ -72,16 +227,102 @@ int ByteStream::get() {
 // m_buf_ptr points to a free buffer position
 //
 void ByteStream::flush() {
-	size_t n_bytes_to_write = m_buf_ptr - m_buf;
+	if(m_buf_ptr != m_buf_start) // If buf is not empty
+		write_block();
+}
 
-	if(n_bytes_to_write != 0) { // If buf is not empty
-		m_fs.write((char*)m_buf, n_bytes_to_write);
-		m_buf_ptr = m_buf;
+//---------------------------------------------------------------------------------
+//
+// Writes out the current buffer and starts a new one. In asynchronous mode
+// the buffer is queued for the writer thread and the next free one of the
+// ring is taken, waiting for the writer only if all of them are queued.
+//
+void ByteStream::write_block() {
+	size_t n = m_buf_ptr - m_buf_start;
+
+	if(m_async == nullptr)
+		write_out(m_buf_start, n);
+
+	else {
+		unique_lock<mutex> lock { m_async->mtx };
+		m_async->full.emplace_back(m_buf_start, n);
+		m_async->cv.notify_all();
+		m_async->cv.wait(lock, [this] { return not m_async->free.empty(); });
+
+		m_buf_start = m_async->free.back();
+		m_async->free.pop_back();
+		m_buf_limit = m_buf_start + BYTE_STREAM_BUF_SIZE;
+	}
+
+	m_buf_ptr = m_buf_start;
+}
+
+//---------------------------------------------------------------------------------
+
+bool ByteStream::write_out(const uint8_t* buf, size_t n) {
+	if(m_vec != nullptr) {
+		m_vec->insert(m_vec->end(), buf, buf + n);
+		return true;
+	}
+
+	m_fs->write((const char*)buf, n);
+	return m_fs->good();
+}
+
+//---------------------------------------------------------------------------------
+//
+// Writer thread: writes queued buffers in order until asked to stop with an
+// empty queue. After an error the remaining buffers are only recycled.
+//
+void ByteStream::async_loop() {
+	unique_lock<mutex> lock { m_async->mtx };
+
+	for(;;) {
+		m_async->cv.wait(lock, [this] { return m_async->stop or not m_async->full.empty(); });
+		if(m_async->full.empty())
+			return;
+
+		auto [buf, n] = m_async->full.front();
+		m_async->full.pop_front();
+		bool failed = m_async->failed;
+
+		lock.unlock();
+		if(not failed and not write_out(buf, n))
+			failed = true;
+		lock.lock();
+
+		m_async->failed = failed;
+		m_async->free.push_back(buf);
+		m_async->cv.notify_all();
 	}
 }
 
 //---------------------------------------------------------------------------------
 
+void ByteStream::stop_async() {
+	if(m_async == nullptr or not m_async->writer.joinable())
+		return;
+
+	{
+		lock_guard<mutex> lock { m_async->mtx };
+		m_async->stop = true;
+	}
+
+	m_async->cv.notify_all();
+	m_async->writer.join();
+}
+
+//---------------------------------------------------------------------------------
+
+bool ByteStream::is_open() {
+	if(m_fs != nullptr)
+		return m_fs->is_open();
+
+	return m_vec != nullptr or m_map != nullptr or m_fd >= 0;
+}
+
+//---------------------------------------------------------------------------------
+
 off_t ByteStream::tell() {
 	return m_tell;
 }
@@ -92,7 +333,37 @@ void ByteStream::close() {
 	if(not m_rw_status)
 		this->flush();
 
-	m_fs.close();
+	stop_async();
+
+	if(m_fs != nullptr)
+		m_fs->close();
+
+	release();
+
+	if(m_async != nullptr and m_async->failed)
+		throw runtime_error("ByteStream: error writing output");
+}
+
+//---------------------------------------------------------------------------------
+
+void ByteStream::release() {
+	if(m_mapped) {
+		munmap(m_map, m_map_size);
+		m_mapped = false;
+	}
+
+	if(m_map != nullptr) {
+		m_map = nullptr;
+		m_map_size = 0;
+		m_buf_start = m_buf_ptr = m_buf_limit = m_buf;
+	}
+
+	m_vec = nullptr;
+
+	if(m_fd >= 0) {
+		::close(m_fd);
+		m_fd = -1;
+	}
 }
 
 //---------------------------------------------------------------------------------
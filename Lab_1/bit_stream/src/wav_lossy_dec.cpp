@@ -41,14 +41,14 @@ int main(int argc, char *argv[]) {
 
     vector<double> block(block_size);
     vector<short> samples(block_size);
+    vector<uint32_t> packed(block_size);
 
     fftw_plan plan = fftw_plan_r2r_1d(static_cast<int>(block_size), block.data(), block.data(), FFTW_REDFT01, FFTW_ESTIMATE);
 
     uint32_t mask = (1u << qbits) - 1u;
     uint32_t signbit = 1u << (qbits - 1);
 
-    bool finished = false;
-    while (!finished) {
+    while (true) {
         
         // read 32-bit scale bit pattern (float)
         int tmp = ibs.read_n_bits(32);
@@ -60,10 +60,10 @@ int main(int argc, char *argv[]) {
         if (scale == 0.0) scale = 1.0;
 
         // read one block of quantized coefficients
+        if (ibs.unpack_fixed(packed.data(), block_size, qbits) < block_size) break;
+
         for (size_t i = 0; i < block_size; ++i) {
-            int v = ibs.read_n_bits(qbits);
-            if (v < 0) { finished = true; break; }
-            uint32_t u = static_cast<uint32_t>(v) & mask;
+            uint32_t u = packed[i] & mask;
             
             // sign-extend
             int32_t sval;
@@ -77,8 +77,6 @@ int main(int argc, char *argv[]) {
             block[i] = coef;
         }
 
-        if (finished) break;
-
         // inverse DCT
         fftw_execute(plan);
 
@@ -66,6 +66,7 @@ int main(int argc, char *argv[]) {
     int channels = sndFile.channels();
     vector<short> input(BLOCK_SIZE * channels);
     vector<double> block(BLOCK_SIZE);
+    vector<uint32_t> packed(BLOCK_SIZE);
 
     fftw_plan plan_dct = fftw_plan_r2r_1d(
         static_cast<int>(BLOCK_SIZE), block.data(), block.data(),
@@ -113,9 +114,9 @@ int main(int argc, char *argv[]) {
             int32_t q = static_cast<int32_t>(round(scaled));
             if (q > max_q) q = max_q;
             if (q < -max_q - 1) q = -max_q - 1;
-            uint32_t packed = static_cast<uint32_t>(q) & mask;
-            obs.write_n_bits(packed, qbits);
+            packed[i] = static_cast<uint32_t>(q) & mask;
         }
+        obs.pack_fixed(packed.data(), BLOCK_SIZE, qbits);
     }
 
     fftw_destroy_plan(plan_dct);
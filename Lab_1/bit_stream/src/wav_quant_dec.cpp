@@ -47,30 +47,27 @@ int main(int argc, char *argv[]) {
     cout << "Decoding: " << input_bin << " -> " << output_wav << endl;
     cout << "Quantization bits: " << qbits << ", Channels: " << nchannels << ", Sample rate: " << sfinfo.samplerate << endl;
 
-    vector<short> decoded_samples;
-    decoded_samples.reserve(FRAMES_BUFFER_SIZE * nchannels);
+    vector<short> decoded_samples(FRAMES_BUFFER_SIZE * nchannels);
+    vector<uint32_t> quantized(decoded_samples.size());
 	int shift_bits = 16 - qbits;
 
-	int quantized_value;
-	while ((quantized_value = ibs.read_n_bits(qbits)) != EOF) {
-					
-		unsigned short quantized_unsigned = ((unsigned short)quantized_value) << shift_bits;
-		int signed_sample = (int)quantized_unsigned - 32768;
-		
-		decoded_samples.push_back((short)signed_sample);
-		
-		//debug_file << "Read: " << quantized_value << " -> " << quantized_unsigned << " -> " << signed_sample << "\n";
-		//debug_file << signed_sample << "\n";
-
-		if (decoded_samples.size() >= FRAMES_BUFFER_SIZE * nchannels) {
-			sndFileOut.writef(decoded_samples.data(), decoded_samples.size() / nchannels);
-			decoded_samples.clear();
+	size_t n;
+	while ((n = ibs.unpack_fixed(quantized.data(), quantized.size(), qbits)) > 0) {
+		for (size_t i = 0; i < n; i++) {
+			unsigned short quantized_unsigned = ((unsigned short)quantized[i]) << shift_bits;
+			int signed_sample = (int)quantized_unsigned - 32768;
+
+			decoded_samples[i] = (short)signed_sample;
+
+			//debug_file << "Read: " << quantized[i] << " -> " << quantized_unsigned << " -> " << signed_sample << "\n";
+			//debug_file << signed_sample << "\n";
 		}
-	}
 
-    if (!decoded_samples.empty()) {
-        sndFileOut.writef(decoded_samples.data(), decoded_samples.size() / nchannels);
-    }
+		sndFileOut.writef(decoded_samples.data(), n / nchannels);
+
+		if (n < quantized.size()) // End of the stream
+			break;
+	}
 	
 	//debug_file.close();
     ibs.close();
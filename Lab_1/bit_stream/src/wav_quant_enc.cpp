@@ -57,6 +57,7 @@ int main(int argc, char *argv[]) {
 	BitStream obs { ofs, STREAM_WRITE };
     size_t nFrames;
 	vector<short> samples(FRAMES_BUFFER_SIZE * sndFile.channels());
+	vector<uint32_t> quantized(samples.size());
 
     obs.write_n_bits(qbits, 8);
     obs.write_n_bits(sndFile.channels(), 8);
@@ -72,8 +73,11 @@ int main(int argc, char *argv[]) {
             //short test = (quantized_unsigned << shift_bits) - 32768;
             //debug_file << test << "\n";
             
-            obs.write_n_bits(quantized_unsigned, qbits);
+            quantized[i] = quantized_unsigned;
         }
+
+        // All values have the same width: pack the whole buffer at once
+        obs.pack_fixed(quantized.data(), samples.size(), qbits);
     }
 
     //debug_file.close();
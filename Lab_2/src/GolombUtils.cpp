@@ -1,5 +1,8 @@
 #include "GolombUtils.h"
+#include <algorithm>
 #include <cstring>
+#include <map>
+#include <vector>
 
 NegativeHandling parse_method(const char* method_str) {
     if (strcmp(method_str, "zigzag") == 0) {
@@ -38,148 +41,327 @@ int retrieve_4B_value(BitStream *bs) {
     return num;
 }
 
-// Golomb Encoding and Decoding
-void GolombUtils::golomb_encode(BitStream *bs, int num) {
-    if (this->neg_handling == ZIGZAG) {
-        encode_zigzag(bs, num);
-    } else if (this->neg_handling == SIGN_MAGNITUDE) {
-        encode_sign_magnitude(bs, num);
-    } else {
-        throw std::invalid_argument("Invalid NegativeHandling value");
+// Golomb decoding table
+const GolombLutEntry* golomb_lut(int m, NegativeHandling neg_handling) {
+    static thread_local std::map<std::pair<int, int>, std::vector<GolombLutEntry>> tables;
+
+    std::vector<GolombLutEntry>& table = tables[{m, neg_handling}];
+    if (!table.empty()) {
+        return table.data();
     }
-}
 
-int GolombUtils::golomb_decode(BitStream *bs) {
-    if (this->neg_handling == ZIGZAG) {
-        return decode_zigzag(bs);
-    } else if (this->neg_handling == SIGN_MAGNITUDE) {
-        return decode_sign_magnitude(bs);
-    } else {
+    if (neg_handling != ZIGZAG && neg_handling != SIGN_MAGNITUDE) {
         throw std::invalid_argument("Invalid NegativeHandling value");
     }
-}
 
+    int m_bits = 0;
+    for (int temp = m; temp != 0; temp >>= 1) {
+        m_bits++;
+    }
+    int cutoff = (int)((int64_t(1) << m_bits) - m);
 
-// Zigzag Encoding and Decoding
-void GolombUtils::encode_zigzag(BitStream *bs, int num) {
-    unsigned int zigzagged = value_signed_to_zigzag(num);
-    encode_unsigned(bs, zigzagged);
-}
+    table.assign(1 << GOLOMB_LUT_BITS, GolombLutEntry{0, 0});
 
-int GolombUtils::decode_zigzag(BitStream *bs) {
-    int val = decode_unsigned(bs);
-    return value_zigzag_to_signed(val);
-}
+    for (int idx = 0; idx < (1 << GOLOMB_LUT_BITS); idx++) {
+        // Bits [pos, pos + n) of the index, most significant first
+        auto bits = [idx](int pos, int n) {
+            return (idx >> (GOLOMB_LUT_BITS - pos - n)) & ((1 << n) - 1);
+        };
 
-int GolombUtils::value_zigzag_to_signed(int num) {
-    return (num>>1) ^ (-(num & 1));
-}
+        int q = 0;
+        while (q < GOLOMB_LUT_BITS && bits(q, 1)) {
+            q++;
+        }
+        int len = q + 1 + (m_bits - 1);
+        if (len > GOLOMB_LUT_BITS) {
+            continue;
+        }
 
-unsigned int GolombUtils::value_signed_to_zigzag(int num) {
-    return (num << 1) ^ (num >> 31);
-}
+        int r = bits(q + 1, m_bits - 1);
+        if (r >= cutoff) {
+            if (len + 1 > GOLOMB_LUT_BITS) {
+                continue;
+            }
+            r = ((r << 1) | bits(len, 1)) - cutoff;
+            len++;
+        }
 
+        long magnitude = (long)q * m + r;
+        long value;
+        if (neg_handling == ZIGZAG) {
+            value = (magnitude >> 1) ^ (-(magnitude & 1));
+        } else if (magnitude == 0) {
+            value = 0;
+        } else {
+            if (len + 1 > GOLOMB_LUT_BITS) {
+                continue;
+            }
+            value = bits(len, 1) ? -magnitude : magnitude;
+            len++;
+        }
 
-// Sign-Magnitude Encoding and Decoding
-void GolombUtils::encode_sign_magnitude(BitStream *bs, int num) {
-    if (num == 0) {
-        // Zero has no sign bit
-        encode_unsigned(bs, 0);
-    } else if (num > 0) {
-        // Positive number
-        encode_unsigned(bs, num);
-        bs->write_bit(0);
-    } else {
-        // Negative number
-        encode_unsigned(bs, -num);
-        bs->write_bit(1);
+        if (value < INT16_MIN || value > INT16_MAX) {
+            continue;
+        }
+
+        table[idx] = GolombLutEntry{(int16_t)value, (uint8_t)len};
     }
+
+    return table.data();
 }
 
-int GolombUtils::decode_sign_magnitude(BitStream *bs) {
-    int magnitude = decode_unsigned(bs);
-    
-    if (magnitude == 0) {
-        // Zero has no sign bit
-        return 0;
+// Exact code length of a block
+GolombCost::GolombCost(std::span<const int> values, NegativeHandling neg_handling, int escape_bits_value)
+    : escape_bits(escape_bits_value), escape_q(golomb_escape_q(escape_bits_value)) {
+    if (neg_handling != ZIGZAG && neg_handling != SIGN_MAGNITUDE) {
+        throw std::invalid_argument("Invalid NegativeHandling value");
     }
-    
-    // Read the sign bit
-    int sign_bit = bs->read_bit();
-    
-    if (sign_bit == 0) {
-        return magnitude;   // Positive
+
+    mapped.resize(values.size());
+    if (neg_handling == ZIGZAG) {
+        for (size_t i = 0; i < values.size(); i++) {
+            mapped[i] = ((uint32_t)values[i] << 1) ^ (uint32_t)(values[i] >> 31);
+        }
     } else {
-        return -magnitude;  // Negative
+        for (size_t i = 0; i < values.size(); i++) {
+            mapped[i] = values[i] < 0 ? -(uint32_t)values[i] : (uint32_t)values[i];
+            sign_bits += values[i] != 0;
+        }
+    }
+
+    for (uint32_t u : mapped) {
+        sum += u;
+        max = std::max(max, u);
     }
 }
 
+uint64_t GolombCost::bits(int m) const {
+    // Lengths are summed per chunk in 32 bits, so the loops vectorize with
+    // 4 lanes
+    const size_t CHUNK = 1 << 15;
 
-// Unsigned Golomb Encoding and Decoding
-void GolombUtils::encode_unsigned(BitStream *bs, unsigned int num) {
-    // golomb_encode(bs, zigzagged);
-    int q = num / this->m;
-    int r = num % this->m;
     int m_bits = 0;
-    
-    // calculate number of bits needed for m
-    int temp = this->m;
-    while (temp != 0)
-    {
+    for (int temp = m; temp != 0; temp >>= 1) {
         m_bits++;
-        temp >>= 1;
     }
+    uint32_t cutoff = (uint32_t)((uint64_t(1) << m_bits) - m);
+    uint32_t escape_len = escape_q + 1 + escape_bits;
+    uint64_t total = sign_bits;
 
-    int cutoff = (1 << m_bits) - this->m;
+    for (size_t base = 0; base < mapped.size(); base += CHUNK) {
+        const uint32_t *u = mapped.data() + base;
+        size_t n = std::min(CHUNK, mapped.size() - base);
+        uint32_t part = 0;
+
+        if ((m & (m - 1)) == 0) {
+            int k = m_bits - 1;
+            for (size_t i = 0; i < n; i++) {
+                uint32_t q = u[i] >> k;
+                part += q < escape_q ? q + 1 + k : escape_len;
+            }
+        } else if (max < (uint32_t(1) << 24)) {
+            // Quotient by the reciprocal, off by at most one, then corrected.
+            // Below 2^24 every step is exact in float, which vectorizes
+            // without a 32-bit integer multiply.
+            float fm = m, inv = 1.0f / m;
+            for (size_t i = 0; i < n; i++) {
+                float x = (float)(int32_t)u[i];
+                float fq = (float)(int32_t)(x * inv);
+                int32_t q = (int32_t)fq;
+                int32_t r = (int32_t)(x - fq * fm);
+                q += (r >= m) - (r < 0);
+                r += (r < 0 ? m : 0) - (r >= m ? m : 0);
+                part += (uint32_t)q < escape_q ? q + m_bits + ((uint32_t)r >= cutoff) : escape_len;
+            }
+        } else {
+            for (size_t i = 0; i < n; i++) {
+                uint32_t q = u[i] / m;
+                uint32_t r = u[i] - q * (uint32_t)m;
+                part += q < escape_q ? q + m_bits + (r >= cutoff) : escape_len;
+            }
+        }
 
-    // Write unary code for quotient
-    for (int i = 0; i < q; i++) {
-        bs->write_bit(1);
+        total += part;
     }
-    bs->write_bit(0);
-    
-    // Write remainder in truncated binary form
-    if (r < cutoff) {
-        // shorter form
-        for (int i = m_bits - 2; i >= 0; i--) {
-            bs->write_bit((r >> i) & 1);
+
+    return total;
+}
+
+// Mapped values grouped by ranges of equal width up to 8 times their mean,
+// about two ranges per value, then the few values above in one last group,
+// so that the values below any x are counted in O(1) on average: those of
+// the groups before that of x, then those of its own group that are below x
+struct ValueIndex {
+    std::vector<uint32_t> &grouped; // Values by group
+    std::vector<uint32_t> &start;   // Index in grouped of the first of each group
+    int shift = 0;                  // Range of u: u >> shift
+    size_t ranges;
+    uint32_t max;
+
+    // The buffers are reused from block to block
+    ValueIndex(const std::vector<uint32_t> &values, uint64_t sum, uint32_t max_value)
+        : grouped(buffer(0)), start(buffer(1)), max(max_value) {
+        uint64_t covered = std::min<uint64_t>(max, 8 * (sum / values.size()) + 1);
+        while ((covered >> shift) >= 2 * values.size()) {
+            shift++;
         }
-    } else {
-        // longer form
-        r += cutoff;
-        for (int i = m_bits - 1; i >= 0; i--) {
-            bs->write_bit((r >> i) & 1);
+        ranges = (covered >> shift) + 1;
+
+        // Counts from start[2], so that after the prefix sums start[g + 1]
+        // is the first of group g, and after placing the values in it, the
+        // first of group g + 1. The loops go through local copies, which
+        // their stores cannot alias.
+        start.assign(ranges + 3, 0);
+        grouped.resize(values.size());
+        uint32_t *first = start.data();
+        uint32_t *out = grouped.data();
+        int s = shift;
+        uint32_t last = (uint32_t)ranges;
+
+        for (uint32_t u : values) {
+            first[std::min(u >> s, last) + 2]++;
+        }
+        for (size_t g = 2; g < start.size(); g++) {
+            first[g] += first[g - 1];
+        }
+        for (uint32_t u : values) {
+            out[first[std::min(u >> s, last) + 1]++] = u;
+        }
+    }
+
+    static std::vector<uint32_t> &buffer(int i) {
+        static thread_local std::vector<uint32_t> buffers[2];
+        return buffers[i];
+    }
+
+    size_t group(uint64_t u) const {
+        return std::min<uint64_t>(u >> shift, ranges);
+    }
+
+    // Number of values below x
+    uint64_t below(uint64_t x) const {
+        if (x > max) {
+            return grouped.size();
         }
+        size_t g = group(x);
+        uint64_t count = start[g];
+        // A range of width 1 has no value below x
+        if (shift > 0 || g == ranges) {
+            for (uint32_t i = start[g]; i < start[g + 1]; i++) {
+                count += grouped[i] < x;
+            }
+        }
+        return count;
+    }
+};
+
+// With P = 2^m_bits, a value u takes q + m_bits + (r >= P - m) bits, which
+// is m_bits + 2 + floor((u - P) / m), or escape_len for a quotient of at
+// least escape_q. While m_bits does not change, the values of at least P take
+// no more bits as m grows, and those below P, m_bits + 1 - (u < P - m) bits,
+// no fewer. These are the bits of each, from a few counts.
+static uint64_t cost_from_pow(const ValueIndex &index, int m, int m_bits,
+                              unsigned int escape_q, uint32_t escape_len) {
+    uint64_t pow = uint64_t(1) << m_bits;
+    uint64_t escape_from = (uint64_t)escape_q * m;
+    uint64_t small = index.below(pow);
+    uint64_t escaped = index.below(escape_from);
+
+    uint64_t total = (escaped - small) * (m_bits + 2) + (index.grouped.size() - escaped) * escape_len;
+    // floor((u - P) / m) counts the multiples of m from P + m up to u
+    for (uint64_t x = pow + m; x < escape_from; x += m) {
+        uint64_t from = index.below(x);
+        if (from >= escaped) {
+            break;
+        }
+        total += escaped - from;
     }
+    return total;
 }
 
-int GolombUtils::decode_unsigned(BitStream *bs){
-    int q = 0;
+static uint64_t cost_below_pow(const ValueIndex &index, int m, int m_bits) {
+    uint64_t pow = uint64_t(1) << m_bits;
+    return index.below(pow) * (m_bits + 1) - index.below(pow - m);
+}
+
+int GolombCost::best_m(bool rice_only) const {
+    const int MAX_K = 29; // Keeps 1 << m_bits within an int
 
-    while(bs->read_bit() != 0) {
-        q++;
+    if (mapped.empty()) {
+        return 1;
     }
 
-    int m_bits = 0;
-    int temp = this->m;
+    ValueIndex index(mapped, sum, max);
+    uint32_t escape_len = escape_q + 1 + escape_bits;
+    auto cost_from = [&](int m, int m_bits) {
+        return cost_from_pow(index, m, m_bits, escape_q, escape_len);
+    };
+    auto cost_below = [&](int m, int m_bits) {
+        return cost_below_pow(index, m, m_bits);
+    };
 
-    while (temp > 0) {
-        m_bits++;
-        temp >>= 1;
+    // Every k up to that of the largest value: beyond it every quotient is 0
+    // and the cost only grows. The cost is not convex in k where values
+    // start to escape, so none is skipped; from the largest k down, a k
+    // whose escapes alone cost more than the best so far is not costed
+    // further.
+    int max_bits = 0;
+    for (uint32_t temp = max; temp != 0; temp >>= 1) {
+        max_bits++;
+    }
+    int k = 0;
+    uint64_t best_bits = UINT64_MAX;
+    for (int kk = std::min(max_bits, MAX_K); kk >= 0; kk--) {
+        uint64_t escaped = mapped.size() - index.below((uint64_t)escape_q << kk);
+        uint64_t at_least = sign_bits + (mapped.size() - escaped) * (kk + 1) + escaped * escape_len;
+        if (at_least > best_bits) {
+            continue;
+        }
+        uint64_t b = sign_bits + cost_from(1 << kk, kk + 1) + cost_below(1 << kk, kk + 1);
+        if (b <= best_bits) {
+            k = kk;
+            best_bits = b;
+        }
     }
-    
-    int cutoff = (1 << m_bits) - this->m;
 
-    // Read remainder in truncated binary form
-    int r = 0;
-    for (int i = m_bits - 2; i >= 0; i--) {
-        r = (r << 1) | bs->read_bit();
+    int best = 1 << k;
+    if (rice_only || k == 0) {
+        return best;
     }
 
-    if (r >= cutoff) {
-        r = (r << 1) | bs->read_bit();
-        r -= cutoff;
+    // Every other m strictly between the neighbouring powers of two, by
+    // branch and bound. No m of a range of m of the same m_bits takes fewer
+    // bits than the values of at least P at its last m and those below at
+    // its first, so ranges that cannot beat the best m found so far are
+    // skipped, and the others halved, the more promising half first.
+    auto search = [&](auto &self, int m1, int m2, int m_bits, uint64_t below1, uint64_t from2) -> void {
+        uint64_t bound = sign_bits + below1 + from2;
+        if (bound >= best_bits) {
+            return;
+        }
+        if (m1 == m2) {
+            best = m1;
+            best_bits = bound;
+            return;
+        }
+        int mid = m1 + (m2 - m1) / 2;
+        uint64_t from_mid = cost_from(mid, m_bits);
+        uint64_t below_next = cost_below(mid + 1, m_bits);
+        if (below1 + from_mid <= below_next + from2) {
+            self(self, m1, mid, m_bits, below1, from_mid);
+            self(self, mid + 1, m2, m_bits, below_next, from2);
+        } else {
+            self(self, mid + 1, m2, m_bits, below_next, from2);
+            self(self, m1, mid, m_bits, below1, from_mid);
+        }
+    };
+
+    // m_bits is k below the best power of two and k + 1 above it
+    int pow = 1 << k, lowest = (1 << (k - 1)) + 1, highest = (1 << (k + 1)) - 1;
+    if (lowest < pow) {
+        search(search, lowest, pow - 1, k, cost_below(lowest, k), cost_from(pow - 1, k));
     }
+    search(search, pow + 1, highest, k + 1, cost_below(pow + 1, k + 1), cost_from(highest, k + 1));
 
-    return q * this->m + r;
+    return best;
 }
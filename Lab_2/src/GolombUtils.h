@@ -1,7 +1,15 @@
+#ifndef GOLOMB_UTILS_H
+#define GOLOMB_UTILS_H
+
 #include "bit_stream/src/bit_stream.h"
+#include <algorithm>
 #include <cmath>
+#include <cstdint>
 #include <iostream>
+#include <span>
 #include <string>
+#include <stdexcept>
+#include <vector>
 
 enum NegativeHandling {
     ZIGZAG = 0,
@@ -12,26 +20,548 @@ NegativeHandling parse_method(const char*);
 void fetch_4B_value(BitStream*, int);
 int retrieve_4B_value(BitStream*);
 
+// Bounded code length (LIMIT escape, as in JPEG-LS)
+//
+// A value whose quotient would reach the escape quotient is sent instead as
+// that many ones, the terminating zero and the mapped value (zigzag or
+// magnitude) in escape_bits plain bits, which must be enough to hold any value
+// of the source. With LIMIT = 2 * (escape_bits + max(8, escape_bits)) no code
+// is longer than LIMIT bits (plus the sign bit of sign-magnitude). The escape
+// quotient is always at least 16, so escapes never fit in the decoding table.
+const int GOLOMB_ESCAPE_BITS = 32;
+
+inline unsigned int golomb_escape_q(int escape_bits) {
+    int limit = 2 * (escape_bits + std::max(8, escape_bits));
+    return limit - escape_bits - 1;
+}
+
+// escape_q ones, the terminating zero and u in escape_bits bits
+template<class Writer>
+inline void golomb_write_escape(Writer *bs, unsigned int escape_q, uint32_t u, int escape_bits) {
+    if (escape_bits < 32 && (u >> escape_bits) != 0) {
+        throw std::invalid_argument("Value too large for the Golomb escape code");
+    }
+
+    while (escape_q >= 32) {
+        bs->write_n_bits(0xFFFFFFFF, 32);
+        escape_q -= 32;
+    }
+    bs->write_n_bits(((uint64_t(1) << escape_q) - 1) << 1, escape_q + 1);
+    bs->write_n_bits(u, escape_bits);
+}
+
+// Escaped value after a quotient of q ones, or EOF for a plain code
+template<class Reader>
+inline int64_t golomb_read_escape(Reader *bs, int q, unsigned int escape_q, int escape_bits) {
+    if (q == EOF) {
+        throw std::runtime_error("Unexpected end of Golomb coded stream");
+    }
+    if ((unsigned int)q < escape_q) {
+        return EOF;
+    }
+    if ((unsigned int)q > escape_q) {
+        throw std::runtime_error("Invalid Golomb code (quotient past the escape)");
+    }
+    uint64_t u = bs->read_n_bits(escape_bits);
+    if (u == ~uint64_t(0)) {
+        throw std::runtime_error("Unexpected end of Golomb coded stream");
+    }
+    return (int64_t)u;
+}
+
+// Decoding table, indexed by the next GOLOMB_LUT_BITS bits of the stream. Each
+// entry holds the signed value of the code starting there and its length, or
+// length 0 if the code is longer than GOLOMB_LUT_BITS bits. Only used when m
+// leaves at least GOLOMB_LUT_MIN_Q_BITS bits of the index for the quotient;
+// larger m (typical of audio) would miss the table too often to pay for it.
+const int GOLOMB_LUT_BITS = 12;
+const int GOLOMB_LUT_MIN_Q_BITS = 4;
+
+struct GolombLutEntry {
+    int16_t value;
+    uint8_t len;
+};
+
+// Built on first use and shared by every coder with the same m and method
+// (per thread)
+const GolombLutEntry* golomb_lut(int m, NegativeHandling neg_handling);
+
 class GolombUtils {
     public:
-        GolombUtils(int m_value, NegativeHandling neg_handling_value)
-            : m(m_value), neg_handling(neg_handling_value) {}
+        GolombUtils(int m_value, NegativeHandling neg_handling_value,
+                    int escape_bits_value = GOLOMB_ESCAPE_BITS)
+            : m(m_value), neg_handling(neg_handling_value),
+              escape_bits(escape_bits_value), escape_q(golomb_escape_q(escape_bits_value)) {
+            if (m <= 0) {
+                throw std::invalid_argument("Golomb m must be positive");
+            }
+
+            // calculate number of bits needed for m (up to 31, so 2^m_bits
+            // is computed in 64 bits)
+            for (int temp = m; temp != 0; temp >>= 1) {
+                m_bits++;
+            }
+            cutoff = (int)((int64_t(1) << m_bits) - m);
+
+            // m = 2^k: Rice code, the remainder is just the k low bits
+            if ((m & (m - 1)) == 0) {
+                rice_k = m_bits - 1;
+            }
+        }
+
+        bool is_rice() const { return rice_k >= 0; }
         
-        void golomb_encode(BitStream *bs, int num);
-        int golomb_decode(BitStream *bs);
+        // Templated on the bit writer/reader (BitStream, or any
+        // BasicBitWriter/BasicBitReader) so the coder inlines into it
+        template<class Writer> void golomb_encode(Writer *bs, int num);
+        template<class Reader> int golomb_decode(Reader *bs);
+
+        // Whole blocks of values, same bits as one golomb_encode/decode each
+        template<class Writer> void encode_block(Writer *bs, std::span<const int> values);
+        template<class Reader> void decode_block(Reader *bs, std::span<int> values);
     
     private:
         int m;
         NegativeHandling neg_handling;
+        int m_bits = 0;
+        int cutoff;
+        int rice_k = -1;
+        int escape_bits;
+        unsigned int escape_q;
+        const GolombLutEntry* lut = nullptr;
 
-        int decode_zigzag(BitStream *bs);
-        void encode_zigzag(BitStream *bs, int num);
-        int value_zigzag_to_signed(int num);
+        template<class Reader> int decode_zigzag(Reader *bs);
+        template<class Writer> void encode_zigzag(Writer *bs, int num);
+        int value_zigzag_to_signed(unsigned int num);
         unsigned int value_signed_to_zigzag(int num);
         
-        void encode_sign_magnitude(BitStream *bs, int num);
-        int decode_sign_magnitude(BitStream *bs);
+        template<class Writer> void encode_sign_magnitude(Writer *bs, int num);
+        template<class Reader> int decode_sign_magnitude(Reader *bs);
         
-        void encode_unsigned(BitStream *bs, unsigned int num);
-        int decode_unsigned(BitStream *bs);
+        template<class Writer> void encode_unsigned(Writer *bs, unsigned int num);
+        template<class Reader> int decode_unsigned(Reader *bs);
+};
+
+// Golomb Encoding and Decoding
+template<class Writer>
+inline void GolombUtils::golomb_encode(Writer *bs, int num) {
+    if (this->neg_handling == ZIGZAG) {
+        encode_zigzag(bs, num);
+    } else if (this->neg_handling == SIGN_MAGNITUDE) {
+        encode_sign_magnitude(bs, num);
+    } else {
+        throw std::invalid_argument("Invalid NegativeHandling value");
+    }
+}
+
+template<class Reader>
+inline int GolombUtils::golomb_decode(Reader *bs) {
+    if (lut == nullptr && m_bits <= GOLOMB_LUT_BITS - GOLOMB_LUT_MIN_Q_BITS) {
+        lut = golomb_lut(this->m, this->neg_handling);
+    }
+
+    // Short codes: one table lookup gives the final value
+    if (lut != nullptr) {
+        GolombLutEntry e = lut[bs->peek_bits(GOLOMB_LUT_BITS)];
+        if (e.len != 0) {
+            if (!bs->skip_bits(e.len)) {
+                throw std::runtime_error("Unexpected end of Golomb coded stream");
+            }
+            return e.value;
+        }
+    }
+
+    if (this->neg_handling == ZIGZAG) {
+        return decode_zigzag(bs);
+    } else if (this->neg_handling == SIGN_MAGNITUDE) {
+        return decode_sign_magnitude(bs);
+    } else {
+        throw std::invalid_argument("Invalid NegativeHandling value");
+    }
+}
+
+
+// Block Encoding and Decoding
+//
+// The block is coded in chunks. For each chunk, the mapping to unsigned, the
+// quotients, remainders and code lengths are computed in separate branch-free
+// loops that the compiler can vectorize, and then the codes are packed with one
+// write per value. Escaped values and codes longer than 64 bits go through
+// golomb_encode.
+template<class Writer>
+inline void GolombUtils::encode_block(Writer *bs, std::span<const int> values) {
+    const size_t CHUNK = 256;
+    uint32_t u[CHUNK], q[CHUNK], r[CHUNK];
+    int r_bits[CHUNK];
+
+    if (this->neg_handling != ZIGZAG && this->neg_handling != SIGN_MAGNITUDE) {
+        throw std::invalid_argument("Invalid NegativeHandling value");
+    }
+
+    for (size_t base = 0; base < values.size(); base += CHUNK) {
+        const int *v = values.data() + base;
+        size_t n = std::min(CHUNK, values.size() - base);
+
+        if (this->neg_handling == ZIGZAG) {
+            for (size_t i = 0; i < n; i++) {
+                u[i] = ((uint32_t)v[i] << 1) ^ (uint32_t)(v[i] >> 31);
+            }
+        } else {
+            for (size_t i = 0; i < n; i++) {
+                u[i] = v[i] < 0 ? -(uint32_t)v[i] : (uint32_t)v[i];
+            }
+        }
+
+        if (rice_k >= 0) {
+            for (size_t i = 0; i < n; i++) {
+                q[i] = u[i] >> rice_k;
+                r[i] = u[i] & (this->m - 1);
+                r_bits[i] = rice_k;
+            }
+        } else {
+            for (size_t i = 0; i < n; i++) {
+                q[i] = u[i] / this->m;
+            }
+            for (size_t i = 0; i < n; i++) {
+                uint32_t rem = u[i] - q[i] * this->m;
+                int longer = (int)rem >= cutoff;
+                r[i] = rem + (longer ? cutoff : 0);
+                r_bits[i] = m_bits - 1 + longer;
+            }
+        }
+
+        // Sign-magnitude: the sign bit follows the remainder, except for zero
+        if (this->neg_handling == SIGN_MAGNITUDE) {
+            for (size_t i = 0; i < n; i++) {
+                int has_sign = u[i] != 0;
+                r[i] = (r[i] << has_sign) | (uint32_t)(v[i] < 0);
+                r_bits[i] += has_sign;
+            }
+        }
+
+        for (size_t i = 0; i < n; i++) {
+            int len = q[i] + 1 + r_bits[i];
+            if (q[i] < escape_q && len <= 64) {
+                uint64_t ones = ((uint64_t(1) << q[i]) - 1) << 1;
+                bs->write_n_bits((ones << r_bits[i]) | r[i], len);
+            } else {
+                golomb_encode(bs, v[i]);
+            }
+        }
+    }
+}
+
+template<class Reader>
+inline void GolombUtils::decode_block(Reader *bs, std::span<int> values) {
+    for (int& v : values) {
+        v = golomb_decode(bs);
+    }
+}
+
+
+// Zigzag Encoding and Decoding
+template<class Writer>
+inline void GolombUtils::encode_zigzag(Writer *bs, int num) {
+    unsigned int zigzagged = value_signed_to_zigzag(num);
+    encode_unsigned(bs, zigzagged);
+}
+
+template<class Reader>
+inline int GolombUtils::decode_zigzag(Reader *bs) {
+    unsigned int val = decode_unsigned(bs);
+    return value_zigzag_to_signed(val);
+}
+
+inline int GolombUtils::value_zigzag_to_signed(unsigned int num) {
+    return (int)(num >> 1) ^ -(int)(num & 1);
+}
+
+inline unsigned int GolombUtils::value_signed_to_zigzag(int num) {
+    return (num << 1) ^ (num >> 31);
+}
+
+
+// Sign-Magnitude Encoding and Decoding
+template<class Writer>
+inline void GolombUtils::encode_sign_magnitude(Writer *bs, int num) {
+    if (num == 0) {
+        // Zero has no sign bit
+        encode_unsigned(bs, 0);
+    } else if (num > 0) {
+        // Positive number
+        encode_unsigned(bs, num);
+        bs->write_bit(0);
+    } else {
+        // Negative number (INT_MIN included)
+        encode_unsigned(bs, 0u - (unsigned int)num);
+        bs->write_bit(1);
+    }
+}
+
+template<class Reader>
+inline int GolombUtils::decode_sign_magnitude(Reader *bs) {
+    int magnitude = decode_unsigned(bs);
+    
+    if (magnitude == 0) {
+        // Zero has no sign bit
+        return 0;
+    }
+    
+    // Read the sign bit
+    int sign_bit = bs->read_bit();
+    
+    if (sign_bit == 0) {
+        return magnitude;   // Positive
+    } else {
+        return (int)(0u - (unsigned int)magnitude);  // Negative
+    }
+}
+
+
+// Unsigned Golomb Encoding and Decoding
+template<class Writer>
+inline void GolombUtils::encode_unsigned(Writer *bs, unsigned int num) {
+    unsigned int q, r;
+    int r_bits;
+
+    if (rice_k >= 0) {
+        // Rice code: shift and mask instead of division
+        q = num >> rice_k;
+        r = num & (this->m - 1);
+        r_bits = rice_k;
+    } else {
+        q = num / this->m;
+        r = num % this->m;
+
+        // Remainder in truncated binary form
+        r_bits = m_bits - 1;
+        if ((int)r >= cutoff) {
+            // longer form
+            r += cutoff;
+            r_bits = m_bits;
+        }
+    }
+
+    if (q >= escape_q) {
+        golomb_write_escape(bs, escape_q, num, escape_bits);
+        return;
+    }
+
+    // Write unary code for quotient, 32 ones at a time
+    while (q >= 32) {
+        bs->write_n_bits(0xFFFFFFFF, 32);
+        q -= 32;
+    }
+
+    // q ones, the terminating zero and the remainder
+    uint64_t ones = ((uint64_t(1) << q) - 1) << 1;
+    if (q + 1 + r_bits <= 64) {
+        bs->write_n_bits((ones << r_bits) | (uint64_t)r, q + 1 + r_bits);
+    } else {
+        bs->write_n_bits(ones, q + 1);
+        bs->write_n_bits(r, r_bits);
+    }
+}
+
+template<class Reader>
+inline int GolombUtils::decode_unsigned(Reader *bs){
+    int q = bs->read_unary();
+    int64_t escaped = golomb_read_escape(bs, q, escape_q, escape_bits);
+    if (escaped != EOF) {
+        return (int)escaped;
+    }
+
+    // The mapped value may not fit in an int for large m: work in unsigned
+    if (rice_k >= 0) {
+        return (int)(((unsigned int)q << rice_k) | (unsigned int)bs->read_bits(rice_k));
+    }
+
+    // Read remainder in truncated binary form
+    int r = bs->read_bits(m_bits - 1);
+
+    if (r >= cutoff) {
+        r = (r << 1) | bs->read_bit();
+        r -= cutoff;
+    }
+
+    return (int)((unsigned int)q * this->m + r);
+}
+
+// Exact code length of a block for any m
+//
+// bits() runs over the mapped values (zigzag or magnitude) without branches,
+// so that the compiler can vectorize it.
+class GolombCost {
+    public:
+        GolombCost(std::span<const int> values, NegativeHandling neg_handling,
+                   int escape_bits = GOLOMB_ESCAPE_BITS);
+
+        // Bits taken by golomb_encode/encode_block of the whole block
+        uint64_t bits(int m) const;
+
+        // Cheapest power of two, then unless rice_only, the cheapest of all
+        // m between its neighbouring powers of two. Both are exact, costed
+        // from counts of the values of the block (see ValueIndex).
+        int best_m(bool rice_only = false) const;
+
+    private:
+        std::vector<uint32_t> mapped;
+        uint64_t sum = 0;
+        uint32_t max = 0;
+        uint64_t sign_bits = 0;
+        int escape_bits;
+        unsigned int escape_q;
 };
+
+// Adaptive Golomb-Rice coding (LOCO-I / JPEG-LS style)
+//
+// k is derived before every value from running statistics of the values
+// already coded: A, the sum of their magnitudes, and N, their count, both
+// halved every ADAPTIVE_GOLOMB_RESET values so that they follow the local
+// statistics. The decoder updates them in the same way, so no parameter is
+// transmitted.
+const int ADAPTIVE_GOLOMB_RESET = 64;
+
+class AdaptiveGolomb {
+    public:
+        // range: span of the values to code (e.g. 256 for 8-bit image
+        // residuals), which sets the initial statistics as in JPEG-LS
+        AdaptiveGolomb(NegativeHandling neg_handling_value, int range,
+                       int escape_bits_value = GOLOMB_ESCAPE_BITS)
+            : neg_handling(neg_handling_value), a_init(std::max(2, (range + 32) / 64)),
+              escape_bits(escape_bits_value), escape_q(golomb_escape_q(escape_bits_value)) {
+            if (neg_handling != ZIGZAG && neg_handling != SIGN_MAGNITUDE) {
+                throw std::invalid_argument("Invalid NegativeHandling value");
+            }
+            reset();
+        }
+
+        // Back to the initial statistics, e.g. at the start of a block
+        void reset() {
+            A = a_init;
+            N = 1;
+        }
+
+        template<class Writer> void encode(Writer *bs, int num);
+        template<class Reader> int decode(Reader *bs);
+        template<class Writer> void encode_block(Writer *bs, std::span<const int> values);
+        template<class Reader> void decode_block(Reader *bs, std::span<int> values);
+
+    private:
+        NegativeHandling neg_handling;
+        int a_init;
+        int escape_bits;
+        unsigned int escape_q;
+        uint64_t A;
+        uint32_t N;
+
+        // Smallest k with N * 2^k >= A. Starting from the difference of their
+        // bit widths, at most one step up is needed.
+        int k() const {
+            int k = std::max(0, (64 - __builtin_clzll(A | 1)) - (32 - __builtin_clz(N)));
+            if ((uint64_t(N) << k) < A) {
+                k++;
+            }
+            return k;
+        }
+
+        void update(uint32_t magnitude) {
+            A += magnitude;
+            if (++N == ADAPTIVE_GOLOMB_RESET) {
+                A >>= 1;
+                N >>= 1;
+            }
+        }
+};
+
+template<class Writer>
+inline void AdaptiveGolomb::encode(Writer *bs, int num) {
+    int k = this->k();
+    uint32_t magnitude = num < 0 ? -(uint32_t)num : (uint32_t)num;
+    uint32_t u;
+    uint64_t r;
+    int r_bits = k;
+
+    if (neg_handling == ZIGZAG) {
+        u = ((uint32_t)num << 1) ^ (uint32_t)(num >> 31);
+        r = u & ((uint64_t(1) << k) - 1);
+    } else {
+        // The sign bit follows the remainder, except for zero
+        u = magnitude;
+        r = u & ((uint64_t(1) << k) - 1);
+        if (u != 0) {
+            r = (r << 1) | (num < 0);
+            r_bits++;
+        }
+    }
+
+    uint64_t q = uint64_t(u) >> k;
+
+    if (q >= escape_q) {
+        golomb_write_escape(bs, escape_q, u, escape_bits);
+        if (neg_handling == SIGN_MAGNITUDE && u != 0) {
+            bs->write_bit(num < 0);
+        }
+        update(magnitude);
+        return;
+    }
+
+    // Write unary code for quotient, 32 ones at a time
+    while (q >= 32) {
+        bs->write_n_bits(0xFFFFFFFF, 32);
+        q -= 32;
+    }
+
+    uint64_t ones = ((uint64_t(1) << q) - 1) << 1;
+    if (q + 1 + r_bits <= 64) {
+        bs->write_n_bits((ones << r_bits) | r, q + 1 + r_bits);
+    } else {
+        bs->write_n_bits(ones, q + 1);
+        bs->write_n_bits(r, r_bits);
+    }
+
+    update(magnitude);
+}
+
+template<class Reader>
+inline int AdaptiveGolomb::decode(Reader *bs) {
+    int k = this->k();
+    int q = bs->read_unary();
+    int64_t escaped = golomb_read_escape(bs, q, escape_q, escape_bits);
+
+    uint32_t u;
+    if (escaped != EOF) {
+        u = (uint32_t)escaped;
+    } else {
+        u = (uint32_t)((uint64_t(q) << k) | bs->read_n_bits(k));
+    }
+    int num;
+
+    if (neg_handling == ZIGZAG) {
+        num = (int)(u >> 1) ^ -(int)(u & 1);
+    } else {
+        num = (int)u;
+        if (u != 0 && bs->read_bit() == 1) {
+            num = -num;
+        }
+    }
+
+    update(num < 0 ? -(uint32_t)num : (uint32_t)num);
+    return num;
+}
+
+template<class Writer>
+inline void AdaptiveGolomb::encode_block(Writer *bs, std::span<const int> values) {
+    for (int v : values) {
+        encode(bs, v);
+    }
+}
+
+template<class Reader>
+inline void AdaptiveGolomb::decode_block(Reader *bs, std::span<int> values) {
+    for (int& v : values) {
+        v = decode(bs);
+    }
+}
+
+#endif
@@ -0,0 +1,93 @@
+#include "HuffmanUtils.h"
+#include <algorithm>
+#include <queue>
+
+// Code lengths
+void huffman_lengths(const uint32_t* counts, uint8_t* lengths) {
+    std::vector<uint32_t> weights(counts, counts + TOKEN_COUNT);
+    std::fill(lengths, lengths + TOKEN_COUNT, 0);
+
+    int used = TOKEN_COUNT - std::count(counts, counts + TOKEN_COUNT, 0u);
+    if (used == 0) {
+        return;
+    }
+    if (used == 1) {
+        lengths[std::find_if(counts, counts + TOKEN_COUNT, [](uint32_t c) { return c != 0; }) - counts] = 1;
+        return;
+    }
+
+    for (;;) {
+        // Merge the two lightest nodes until one is left. Nodes below
+        // TOKEN_COUNT are the tokens; parent[] links each node to its merge.
+        std::vector<int> parent(2 * TOKEN_COUNT, -1);
+        std::priority_queue<std::pair<uint64_t, int>, std::vector<std::pair<uint64_t, int>>, std::greater<>> heap;
+        for (int t = 0; t < TOKEN_COUNT; t++) {
+            if (weights[t] != 0) {
+                heap.push({weights[t], t});
+            }
+        }
+
+        int next = TOKEN_COUNT;
+        while (heap.size() > 1) {
+            auto [w1, n1] = heap.top();
+            heap.pop();
+            auto [w2, n2] = heap.top();
+            heap.pop();
+            parent[n1] = parent[n2] = next;
+            heap.push({w1 + w2, next++});
+        }
+
+        // Length of a token = its depth
+        int longest = 0;
+        for (int t = 0; t < TOKEN_COUNT; t++) {
+            if (weights[t] != 0) {
+                int depth = 0;
+                for (int node = t; parent[node] != -1; node = parent[node]) {
+                    depth++;
+                }
+                lengths[t] = depth;
+                longest = std::max(longest, depth);
+            }
+        }
+
+        if (longest <= HUFFMAN_MAX_BITS) {
+            return;
+        }
+
+        // Flatten the distribution and try again
+        for (uint32_t& w : weights) {
+            w = (w + 1) / 2;
+        }
+    }
+}
+
+// Canonical codes: consecutive values within a length, in token order, and
+// each length continuing from the last code of the one before, doubled
+bool huffman_codes(const uint8_t* lengths, uint32_t* codes) {
+    uint32_t length_counts[HUFFMAN_MAX_BITS + 1] = {0};
+    for (int t = 0; t < TOKEN_COUNT; t++) {
+        if (lengths[t] > HUFFMAN_MAX_BITS) {
+            return false;
+        }
+        length_counts[lengths[t]]++;
+    }
+    length_counts[0] = 0; // Absent tokens
+
+    uint32_t next_code[HUFFMAN_MAX_BITS + 1];
+    uint32_t code = 0;
+    for (int length = 1; length <= HUFFMAN_MAX_BITS; length++) {
+        code = (code + length_counts[length - 1]) << 1;
+        next_code[length] = code;
+        if (code + length_counts[length] > (1u << length)) {
+            return false; // Over-subscribed
+        }
+    }
+
+    for (int t = 0; t < TOKEN_COUNT; t++) {
+        if (lengths[t] != 0) {
+            codes[t] = next_code[lengths[t]]++;
+        }
+    }
+
+    return true;
+}
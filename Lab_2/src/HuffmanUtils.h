@@ -0,0 +1,152 @@
+#ifndef HUFFMAN_UTILS_H
+#define HUFFMAN_UTILS_H
+
+#include "bit_stream/src/bit_stream.h"
+#include "TokenUtils.h"
+#include <cstdint>
+#include <span>
+#include <stdexcept>
+#include <vector>
+
+// Canonical Huffman coding of residual blocks
+//
+// Values are split into tokens and raw bits (TokenUtils.h). The tokens of a
+// block get a Huffman code of at most HUFFMAN_MAX_BITS bits, sent as the code
+// length of each token: codes are assigned canonically (by length, then by
+// token), so the lengths are all the decoder needs. It decodes a token with
+// one lookup of the next HUFFMAN_MAX_BITS bits in a table.
+//
+// Unlike a Golomb code, any shape of distribution (heavy tails, several
+// modes) gets its own code; unlike rANS, every token costs a whole number of
+// bits, but encoding and decoding are plain table lookups.
+//
+// Block layout:
+//   k (5 bits)
+//   number of tokens used (7 bits), then the code length of each (0 for an
+//   absent token) less the previous one (0 before the first), as a model
+//   delta (write_model_delta)
+//   code and raw bits of each value, in order
+const int HUFFMAN_MAX_BITS = 12;
+
+// Code lengths for the token counts: a Huffman code, with the counts halved
+// until no code is longer than HUFFMAN_MAX_BITS. A lone token gets a 1-bit
+// code.
+void huffman_lengths(const uint32_t* counts, uint8_t* lengths);
+
+// Canonical codes of the lengths. Returns false if the lengths do not make a
+// prefix code.
+bool huffman_codes(const uint8_t* lengths, uint32_t* codes);
+
+class HuffmanCoder {
+    public:
+        template<class Writer> void encode_block(Writer *bs, std::span<const int> values);
+        template<class Reader> void decode_block(Reader *bs, std::span<int> values);
+
+    private:
+        // Decoding table: token << 4 | code length of each HUFFMAN_MAX_BITS
+        // bit prefix, 0 for a prefix of no code
+        std::vector<uint16_t> table;
+};
+
+template<class Writer>
+inline void HuffmanCoder::encode_block(Writer *bs, std::span<const int> values) {
+    uint32_t counts[TOKEN_COUNT] = {0};
+    uint8_t lengths[TOKEN_COUNT];
+    uint32_t codes[TOKEN_COUNT];
+
+    if (values.empty()) {
+        return;
+    }
+
+    int k = token_low_bits(values);
+    bs->write_n_bits(k, 5);
+
+    uint32_t token;
+    uint64_t raw;
+    for (int v : values) {
+        token_split(token_zigzag(v), k, token, raw);
+        counts[token]++;
+    }
+
+    // Code
+    huffman_lengths(counts, lengths);
+    huffman_codes(lengths, codes);
+
+    int used = 0;
+    for (int t = 0; t < TOKEN_COUNT; t++) {
+        if (lengths[t] != 0) {
+            used = t + 1;
+        }
+    }
+
+    bs->write_n_bits(used, 7);
+    int prev = 0;
+    for (int t = 0; t < used; t++) {
+        write_model_delta(bs, lengths[t] - prev);
+        prev = lengths[t];
+    }
+
+    // Values
+    for (int v : values) {
+        int bits = token_split(token_zigzag(v), k, token, raw);
+        bs->write_n_bits(((uint64_t)codes[token] << bits) | raw, lengths[token] + bits);
+    }
+}
+
+template<class Reader>
+inline void HuffmanCoder::decode_block(Reader *bs, std::span<int> values) {
+    uint8_t lengths[TOKEN_COUNT] = {0};
+    uint32_t codes[TOKEN_COUNT];
+
+    if (values.empty()) {
+        return;
+    }
+
+    // Code
+    uint64_t k = bs->read_n_bits(5);
+    uint64_t used = bs->read_n_bits(7);
+    if (k > 30 || used == 0 || used > (uint64_t)TOKEN_COUNT) {
+        throw std::runtime_error("Invalid Huffman code");
+    }
+
+    int prev = 0;
+    for (uint64_t t = 0; t < used; t++) {
+        int length = prev + read_model_delta(bs);
+        if (length < 0 || length > HUFFMAN_MAX_BITS) {
+            throw std::runtime_error("Invalid Huffman code");
+        }
+        lengths[t] = length;
+        prev = length;
+    }
+
+    if (!huffman_codes(lengths, codes)) {
+        throw std::runtime_error("Invalid Huffman code");
+    }
+
+    table.assign(1 << HUFFMAN_MAX_BITS, 0);
+    for (uint64_t t = 0; t < used; t++) {
+        if (lengths[t] != 0) {
+            int shift = HUFFMAN_MAX_BITS - lengths[t];
+            std::fill(table.begin() + (codes[t] << shift), table.begin() + ((codes[t] + 1) << shift), (t << 4) | lengths[t]);
+        }
+    }
+
+    // Values
+    for (int& v : values) {
+        uint16_t entry = table[bs->peek_bits(HUFFMAN_MAX_BITS)];
+        if (entry == 0 || !bs->skip_bits(entry & 15)) {
+            throw std::runtime_error("Invalid Huffman coded value");
+        }
+
+        uint32_t token = entry >> 4;
+        uint64_t raw = bs->read_n_bits(token_extra_bits(token) + k);
+        if (raw == ~uint64_t(0)) {
+            throw std::runtime_error("Unexpected end of Huffman coded stream");
+        }
+
+        uint32_t u = token_join(token, k, raw);
+        v = (int)(u >> 1) ^ -(int)(u & 1);
+    }
+}
+
+#endif
@@ -0,0 +1,60 @@
+#include "RansUtils.h"
+#include <cmath>
+
+// Frequency scaling
+void rans_normalize(const uint32_t* counts, uint32_t* freqs) {
+    const uint32_t total = 1u << RANS_SCALE_BITS;
+    uint64_t sum = 0;
+    for (int t = 0; t < TOKEN_COUNT; t++) {
+        sum += counts[t];
+    }
+
+    if (sum == 0) {
+        std::fill(freqs, freqs + TOKEN_COUNT, 0);
+        return;
+    }
+
+    // Proportional share, at least 1 for a used token
+    uint32_t assigned = 0;
+    int largest = 0;
+    for (int t = 0; t < TOKEN_COUNT; t++) {
+        freqs[t] = 0;
+        if (counts[t] != 0) {
+            freqs[t] = std::max<uint64_t>(1, (uint64_t)counts[t] * total / sum);
+            assigned += freqs[t];
+        }
+        if (counts[t] > counts[largest]) {
+            largest = t;
+        }
+    }
+
+    // Rounding down leaves slots over, which go to the most frequent token.
+    // The minimum of 1 can take too many instead: those are taken back from
+    // the tokens that can best afford them.
+    if (assigned < total) {
+        freqs[largest] += total - assigned;
+    }
+    while (assigned > total) {
+        int t_best = -1;
+        for (int t = 0; t < TOKEN_COUNT; t++) {
+            if (freqs[t] > 1 && (t_best < 0 || freqs[t] > freqs[t_best])) {
+                t_best = t;
+            }
+        }
+        freqs[t_best]--;
+        assigned--;
+    }
+}
+
+// Model weights
+uint32_t rans_weight_code(uint32_t count, uint32_t max_count) {
+    if (count == 0) {
+        return 0;
+    }
+    long down = std::lround(4.0 * std::log2((double)max_count / count));
+    return (uint32_t)std::max(1L, RANS_WEIGHT_CODES - 1 - down);
+}
+
+uint32_t rans_weight(uint32_t code) {
+    return code == 0 ? 0 : (uint32_t)std::lround(std::exp2((code - 1) / 4.0));
+}
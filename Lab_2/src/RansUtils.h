@@ -0,0 +1,304 @@
+#ifndef RANS_UTILS_H
+#define RANS_UTILS_H
+
+#include "bit_stream/src/bit_stream.h"
+#include "TokenUtils.h"
+#include <algorithm>
+#include <cstdint>
+#include <span>
+#include <stdexcept>
+#include <vector>
+
+// rANS entropy coding of residual blocks
+//
+// Values are split into tokens and raw bits (TokenUtils.h). The tokens of a
+// block are coded with a static rANS model sent before it, so a block of a single value (e.g. silence) costs no bits
+// per value. The model is sent compactly as a weight per token on a quarter
+// octave log scale, each as its difference from the one before (which varies
+// little for the smooth distributions of residuals); both sides scale the
+// weights to frequencies summing to 2^RANS_SCALE_BITS in the same way.
+//
+// RANS_STATES states are interleaved (value i uses state i % RANS_STATES), so
+// that the decoder has independent dependency chains to overlap. The encoder
+// starts each state at RANS_L plus RANS_STASH_BYTES bytes of the block's raw
+// (extra and low) bits instead of at RANS_L, and the decoder gets them back
+// from the states it ends with, so the final states cost 8 bits each rather
+// than 32.
+//
+// Block layout:
+//   k (5 bits)
+//   number of tokens used (7 bits), then the weight code of each (0 for an
+//   absent token) less the previous one (RANS_WEIGHT_CODES - 1 before the
+//   first), as a model delta (write_model_delta)
+//   rANS payload size in bytes (bit width of its bound for the block's
+//   length, 2 bytes per value and the final states), then the payload
+//   extra bits and then k low bits of each value, in order, less the whole
+//   bytes of them (up to RANS_STASH_BYTES per state) carried by the states
+const int RANS_SCALE_BITS = 12;
+const int RANS_STATES = 4;
+const uint32_t RANS_L = 1u << 23; // Lower bound of the normalized states
+const int RANS_STASH_BYTES = 3;   // Raw bytes carried by each initial state
+const int RANS_WEIGHT_BITS = 6;
+const int RANS_WEIGHT_CODES = 1 << RANS_WEIGHT_BITS;
+
+// Scales counts (or weights) to frequencies summing to 2^RANS_SCALE_BITS,
+// keeping every used token at frequency 1 or more
+void rans_normalize(const uint32_t* counts, uint32_t* freqs);
+
+// Weight code of a count, relative to the largest count of the block (which
+// gets the largest code), and the weight of a code
+uint32_t rans_weight_code(uint32_t count, uint32_t max_count);
+uint32_t rans_weight(uint32_t code);
+
+// Width of the payload size field of a block of n values
+inline int rans_size_bits(size_t n) {
+    return 64 - __builtin_clzll(2 * n + 4 * RANS_STATES);
+}
+
+class RansCoder {
+    public:
+        template<class Writer> void encode_block(Writer *bs, std::span<const int> values);
+        template<class Reader> void decode_block(Reader *bs, std::span<int> values);
+
+    private:
+        // Buffers reused from block to block
+        std::vector<uint8_t> tokens;
+        std::vector<uint8_t> payload;
+        std::vector<uint8_t> slot_token; // Token of each of the 2^RANS_SCALE_BITS slots
+};
+
+template<class Writer>
+inline void RansCoder::encode_block(Writer *bs, std::span<const int> values) {
+    size_t n = values.size();
+    uint32_t counts[TOKEN_COUNT] = {0};
+    uint32_t freqs[TOKEN_COUNT], starts[TOKEN_COUNT];
+
+    if (n == 0) {
+        return;
+    }
+
+    int k = token_low_bits(values);
+    bs->write_n_bits(k, 5);
+
+    tokens.resize(n);
+    uint64_t raw_bits = 0;
+    uint32_t token;
+    uint64_t raw;
+    for (size_t i = 0; i < n; i++) {
+        raw_bits += token_split(token_zigzag(values[i]), k, token, raw);
+        tokens[i] = token;
+        counts[token]++;
+    }
+
+    // Model
+    uint32_t max_count = *std::max_element(counts, counts + TOKEN_COUNT);
+    uint32_t weights[TOKEN_COUNT];
+    int used = 0;
+    for (int t = 0; t < TOKEN_COUNT; t++) {
+        weights[t] = rans_weight_code(counts[t], max_count);
+        if (weights[t] != 0) {
+            used = t + 1;
+        }
+    }
+
+    bs->write_n_bits(used, 7);
+    int prev = RANS_WEIGHT_CODES - 1;
+    for (int t = 0; t < used; t++) {
+        write_model_delta(bs, (int)weights[t] - prev);
+        prev = weights[t];
+        weights[t] = rans_weight(weights[t]);
+    }
+
+    rans_normalize(weights, freqs);
+    uint32_t start = 0;
+    for (int t = 0; t < used; t++) {
+        starts[t] = start;
+        start += freqs[t];
+    }
+
+    // Raw bits for the initial states: the first stash_bits of them, taken
+    // bit by bit, leaving value i - 1 with "left" bits still to send
+    uint8_t stash[RANS_STASH_BYTES * RANS_STATES] = {0};
+    uint64_t stash_bits = std::min<uint64_t>(raw_bits / 8, sizeof stash) * 8;
+    size_t i = 0;
+    int left = 0;
+    raw = 0;
+    for (uint64_t pos = 0; pos < stash_bits; pos++) {
+        while (left == 0) {
+            left = token_split(token_zigzag(values[i++]), k, token, raw);
+        }
+        left--;
+        stash[pos / 8] |= ((raw >> left) & 1) << (7 - pos % 8);
+    }
+
+    uint32_t x[RANS_STATES];
+    for (int s = 0; s < RANS_STATES; s++) {
+        const uint8_t *b = stash + RANS_STASH_BYTES * s;
+        x[s] = RANS_L + ((b[0] << 16) | (b[1] << 8) | b[2]);
+    }
+
+    // Tokens, coded backwards into the end of the buffer so that the decoder
+    // reads forwards. Each value emits at most two bytes.
+    payload.resize(2 * n + 4 * RANS_STATES);
+    uint8_t *end = payload.data() + payload.size();
+    uint8_t *p = end;
+
+    for (size_t j = n; j-- > 0; ) {
+        uint32_t& xs = x[j % RANS_STATES];
+        uint32_t f = freqs[tokens[j]];
+        uint32_t x_max = ((RANS_L >> RANS_SCALE_BITS) << 8) * f;
+        while (xs >= x_max) {
+            *--p = (uint8_t)xs;
+            xs >>= 8;
+        }
+        xs = ((xs / f) << RANS_SCALE_BITS) + (xs % f) + starts[tokens[j]];
+    }
+
+    // Final states, the first one read first
+    for (int s = RANS_STATES; s-- > 0; ) {
+        p -= 4;
+        p[0] = (uint8_t)x[s];
+        p[1] = (uint8_t)(x[s] >> 8);
+        p[2] = (uint8_t)(x[s] >> 16);
+        p[3] = (uint8_t)(x[s] >> 24);
+    }
+
+    size_t size = end - p;
+    bs->write_n_bits(size, rans_size_bits(n));
+    bs->write_bytes(std::span<const uint8_t>(p, size), uint64_t(size) * 8);
+
+    // The rest of the raw bits
+    bs->write_n_bits(raw, left);
+    for (; i < n; i++) {
+        int bits = token_split(token_zigzag(values[i]), k, token, raw);
+        bs->write_n_bits(raw, bits);
+    }
+}
+
+template<class Reader>
+inline void RansCoder::decode_block(Reader *bs, std::span<int> values) {
+    size_t n = values.size();
+    uint32_t weights[TOKEN_COUNT] = {0};
+    uint32_t freqs[TOKEN_COUNT], starts[TOKEN_COUNT];
+
+    if (n == 0) {
+        return;
+    }
+
+    // Model
+    uint64_t k = bs->read_n_bits(5);
+    uint64_t used = bs->read_n_bits(7);
+    if (k > 30 || used > (uint64_t)TOKEN_COUNT) {
+        throw std::runtime_error("Invalid rANS model");
+    }
+    int prev = RANS_WEIGHT_CODES - 1;
+    for (uint64_t t = 0; t < used; t++) {
+        int code = prev + read_model_delta(bs);
+        if (code < 0 || code >= RANS_WEIGHT_CODES) {
+            throw std::runtime_error("Invalid rANS model");
+        }
+        weights[t] = rans_weight(code);
+        prev = code;
+    }
+
+    rans_normalize(weights, freqs);
+    if (std::count(freqs, freqs + TOKEN_COUNT, 0u) == TOKEN_COUNT) {
+        throw std::runtime_error("Invalid rANS model");
+    }
+
+    slot_token.resize(1 << RANS_SCALE_BITS);
+    uint32_t start = 0;
+    for (int t = 0; t < TOKEN_COUNT; t++) {
+        starts[t] = start;
+        std::fill(slot_token.begin() + start, slot_token.begin() + start + freqs[t], t);
+        start += freqs[t];
+    }
+
+    // Payload
+    uint64_t size = bs->read_n_bits(rans_size_bits(n));
+    if (size < 4 * RANS_STATES || size > 2 * n + 4 * RANS_STATES) {
+        throw std::runtime_error("Invalid rANS payload size");
+    }
+    payload.resize(size);
+    if (bs->read_bytes(payload) != size) {
+        throw std::runtime_error("Unexpected end of rANS coded stream");
+    }
+
+    const uint8_t *p = payload.data();
+    const uint8_t *end = p + size;
+    uint32_t x[RANS_STATES];
+    for (int s = 0; s < RANS_STATES; s++, p += 4) {
+        x[s] = p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+    }
+
+    // Tokens, one group of RANS_STATES values (one per state) at a time
+    const uint32_t mask = (1u << RANS_SCALE_BITS) - 1;
+    auto decode = [&](uint32_t& xs) {
+        uint32_t t = slot_token[xs & mask];
+        xs = freqs[t] * (xs >> RANS_SCALE_BITS) + (xs & mask) - starts[t];
+        while (xs < RANS_L) {
+            if (p == end) {
+                throw std::runtime_error("Invalid rANS payload");
+            }
+            xs = (xs << 8) | *p++;
+        }
+        return (int)t;
+    };
+
+    size_t i = 0;
+    for (; i + RANS_STATES <= n; i += RANS_STATES) {
+        for (int s = 0; s < RANS_STATES; s++) {
+            values[i + s] = decode(x[s]);
+        }
+    }
+    for (int s = 0; i < n; i++, s++) {
+        values[i] = decode(x[s]);
+    }
+
+    // The decoder ends where the encoder started, which gives back the raw
+    // bits stashed in the initial states
+    uint64_t raw_bits = 0;
+    for (int v : values) {
+        raw_bits += token_extra_bits(v) + k;
+    }
+
+    uint8_t stash[RANS_STASH_BYTES * RANS_STATES];
+    uint64_t stash_bits = std::min<uint64_t>(raw_bits / 8, sizeof stash) * 8;
+    for (int s = 0; s < RANS_STATES; s++) {
+        uint32_t bytes = x[s] - RANS_L;
+        if (x[s] < RANS_L || bytes >= (1u << (8 * RANS_STASH_BYTES)) || p != end) {
+            throw std::runtime_error("Invalid rANS payload");
+        }
+        uint8_t *b = stash + RANS_STASH_BYTES * s;
+        b[0] = bytes >> 16;
+        b[1] = bytes >> 8;
+        b[2] = bytes;
+    }
+    for (size_t b = stash_bits / 8; b < sizeof stash; b++) {
+        if (stash[b] != 0) {
+            throw std::runtime_error("Invalid rANS payload");
+        }
+    }
+
+    // Raw bits, the stashed ones first, and back to signed values
+    uint64_t pos = 0;
+    for (int& v : values) {
+        int bits = token_extra_bits(v) + k;
+        uint64_t raw = 0;
+        for (; bits > 0 && pos < stash_bits; bits--, pos++) {
+            raw = (raw << 1) | ((stash[pos / 8] >> (7 - pos % 8)) & 1);
+        }
+        if (bits > 0) {
+            uint64_t rest = bs->read_n_bits(bits);
+            if (rest == ~uint64_t(0)) {
+                throw std::runtime_error("Unexpected end of rANS coded stream");
+            }
+            raw = (raw << bits) | rest;
+        }
+
+        uint32_t u = token_join(v, k, raw);
+        v = (int)(u >> 1) ^ -(int)(u & 1);
+    }
+}
+
+#endif
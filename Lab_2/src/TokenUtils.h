@@ -0,0 +1,94 @@
+#ifndef TOKEN_UTILS_H
+#define TOKEN_UTILS_H
+
+#include "UniversalCodes.h"
+#include <algorithm>
+#include <cstdint>
+#include <span>
+#include <stdexcept>
+
+// Splitting of residuals into tokens, for the entropy coders of RansUtils.h
+// and HuffmanUtils.h
+//
+// Each value is zigzag mapped and, as in a Rice code, split into a quotient
+// and k low bits, with k chosen per block so that quotients are a few units.
+// The quotient is split into a token and extra bits: below TOKEN_DIRECT it is
+// its own token; larger ones are sent as their bit length and the bit after
+// the leading one, followed by the bits below those as they are. The coders
+// model the tokens and send the raw bits (extra, then low) as they are.
+const int TOKEN_DIRECT = 16;
+const int TOKEN_COUNT = TOKEN_DIRECT + 2 * (32 - 4);
+const int TOKEN_LOW_BITS_OFFSET = 2;
+
+inline uint32_t token_zigzag(int v) {
+    return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+// Low bits of a block: from the median bit width of the mapped values, so
+// that a few outliers do not move it (the Rice k would leave quotients
+// averaging below 1)
+inline int token_low_bits(std::span<const int> values) {
+    uint32_t width_counts[33] = {0};
+    for (int v : values) {
+        uint32_t u = token_zigzag(v);
+        width_counts[u == 0 ? 0 : 32 - __builtin_clz(u)]++;
+    }
+
+    int width = 0;
+    for (size_t below = 0; (below += width_counts[width]) < (values.size() + 1) / 2; ) {
+        width++;
+    }
+    return std::max(0, width - TOKEN_LOW_BITS_OFFSET);
+}
+
+// Token and raw bits (extra, then k low bits) of a mapped value, returning
+// the number of raw bits
+inline int token_split(uint32_t u, int k, uint32_t& token, uint64_t& raw) {
+    uint32_t q = u >> k;
+    uint64_t low = u & ((1u << k) - 1);
+    if (q < (uint32_t)TOKEN_DIRECT) {
+        token = q;
+        raw = low;
+        return k;
+    }
+
+    int n = 31 - __builtin_clz(q); // Position of the leading one, 4 or more
+    int extra_bits = n - 1;
+    token = TOKEN_DIRECT + 2 * (n - 4) + ((q >> (n - 1)) & 1);
+    raw = ((uint64_t)(q & ((1u << extra_bits) - 1)) << k) | low;
+    return extra_bits + k;
+}
+
+// Extra bits of a token
+inline int token_extra_bits(uint32_t token) {
+    return token < (uint32_t)TOKEN_DIRECT ? 0 : 3 + (token - TOKEN_DIRECT) / 2;
+}
+
+// Inverse of token_split(): the mapped value of a token and its raw bits.
+// Throws if they would not fit in 32 bits (corrupt input).
+inline uint32_t token_join(uint32_t token, int k, uint64_t raw) {
+    int extra_bits = token_extra_bits(token);
+    if (extra_bits + k > 30) {
+        throw std::runtime_error("Invalid entropy coded value");
+    }
+
+    uint32_t q = token;
+    if (extra_bits > 0) {
+        q = (2 | ((token - TOKEN_DIRECT) & 1)) << extra_bits;
+    }
+    return (q << k) | (uint32_t)raw;
+}
+
+// Model fields (e.g. the difference of a weight or code length from the
+// previous one), in an order-1 Exp-Golomb code
+template<class Writer>
+inline void write_model_delta(Writer *bs, int delta) {
+    UniversalCoder(EXP_GOLOMB, 1).encode(bs, delta);
+}
+
+template<class Reader>
+inline int read_model_delta(Reader *bs) {
+    return UniversalCoder(EXP_GOLOMB, 1).decode(bs);
+}
+
+#endif
@@ -0,0 +1,214 @@
+#ifndef UNIVERSAL_CODES_H
+#define UNIVERSAL_CODES_H
+
+#include "GolombUtils.h"
+#include <cstdint>
+#include <span>
+#include <stdexcept>
+
+// Exp-Golomb and Elias codes: parameter free (Elias) or nearly so (the order
+// k of Exp-Golomb), for fields whose range is not known in advance, such as
+// block parameters, and for wide-range residuals. The code of u is about
+// 2 log2(u) bits long (log2(u) + 2 log2(log2(u)) for Elias delta), so small
+// values cost a few bits and no value needs a fixed width.
+//
+// Unsigned values u >= 0 are coded as:
+//   EXP_GOLOMB (order k)  w = u + 2^k in n bits: n - 1 - k zeros, then w
+//   ELIAS_GAMMA           the Elias gamma code of u + 1, i.e. order 0
+//                         Exp-Golomb of u
+//   ELIAS_DELTA           x = u + 1 of bit length n: the Elias gamma code of
+//                         n, then the n - 1 bits of x below its leading one
+// Signed values are mapped first, as in GolombUtils: zigzag, or the magnitude
+// followed by a sign bit when it is not 0.
+//
+// Decoding counts the leading zeros of the next 56 bits with one clz.
+enum UniversalCode {
+    EXP_GOLOMB = 0,
+    ELIAS_GAMMA = 1,
+    ELIAS_DELTA = 2,
+};
+
+class UniversalCoder {
+    public:
+        explicit UniversalCoder(UniversalCode code, int k = 0, NegativeHandling neg = ZIGZAG);
+
+        template<class Writer> void encode_unsigned(Writer *bs, uint64_t u) const;
+        template<class Reader> uint64_t decode_unsigned(Reader *bs) const;
+
+        // Length in bits of the code of u
+        int length_unsigned(uint64_t u) const;
+
+        template<class Writer> void encode(Writer *bs, int num) const;
+        template<class Reader> int decode(Reader *bs) const;
+
+        template<class Writer> void encode_block(Writer *bs, std::span<const int> values) const;
+        template<class Reader> void decode_block(Reader *bs, std::span<int> values) const;
+
+    private:
+        UniversalCode code;
+        int k;
+        NegativeHandling neg_handling;
+
+        template<class Writer> static void write_exp_golomb(Writer *bs, uint64_t u, int k);
+        template<class Reader> static uint64_t read_exp_golomb(Reader *bs, int k);
+};
+
+inline UniversalCoder::UniversalCoder(UniversalCode code, int k, NegativeHandling neg) : code(code), k(code == EXP_GOLOMB ? k : 0), neg_handling(neg) {
+    if (code < EXP_GOLOMB || code > ELIAS_DELTA) {
+        throw std::invalid_argument("Invalid UniversalCode value");
+    }
+    if (k < 0 || k > 32) {
+        throw std::invalid_argument("Exp-Golomb order must be between 0 and 32");
+    }
+    if (neg != ZIGZAG && neg != SIGN_MAGNITUDE) {
+        throw std::invalid_argument("Invalid NegativeHandling value");
+    }
+}
+
+// Exp-Golomb of order k, for u < 2^63. When the whole code fits in 64 bits
+// the zeros are written along with w, as its leading bits.
+template<class Writer>
+inline void UniversalCoder::write_exp_golomb(Writer *bs, uint64_t u, int k) {
+    if (u >= (uint64_t(1) << 63) - (uint64_t(1) << k)) {
+        throw std::invalid_argument("Value too large for the Exp-Golomb code");
+    }
+
+    uint64_t w = u + (uint64_t(1) << k);
+    int n = 64 - __builtin_clzll(w);
+    int zeros = n - 1 - k;
+    if (zeros + n <= 64) {
+        bs->write_n_bits(w, zeros + n);
+    } else {
+        bs->write_n_bits(0, zeros);
+        bs->write_n_bits(w, n);
+    }
+}
+
+template<class Reader>
+inline uint64_t UniversalCoder::read_exp_golomb(Reader *bs, int k) {
+    int zeros = 0;
+    for (;;) {
+        uint64_t next = bs->peek_bits(56); // Zero padded past the end
+        if (next != 0) {
+            int run = __builtin_clzll(next) - 8;
+            zeros += run;
+            bs->skip_bits(run);
+            break;
+        }
+        if (!bs->skip_bits(56)) {
+            throw std::runtime_error("Unexpected end of Exp-Golomb coded stream");
+        }
+        zeros += 56;
+        if (zeros > 63) {
+            throw std::runtime_error("Invalid Exp-Golomb code");
+        }
+    }
+
+    int n = zeros + k + 1; // Bits of w, the leading one included
+    if (n > 63) {
+        throw std::runtime_error("Invalid Exp-Golomb code");
+    }
+    uint64_t w = bs->read_n_bits(n);
+    if (w == ~uint64_t(0)) {
+        throw std::runtime_error("Unexpected end of Exp-Golomb coded stream");
+    }
+    return w - (uint64_t(1) << k);
+}
+
+template<class Writer>
+inline void UniversalCoder::encode_unsigned(Writer *bs, uint64_t u) const {
+    if (code != ELIAS_DELTA) {
+        write_exp_golomb(bs, u, k);
+        return;
+    }
+
+    if (u == ~uint64_t(0)) {
+        throw std::invalid_argument("Value too large for the Elias delta code");
+    }
+    uint64_t x = u + 1;
+    int n = 64 - __builtin_clzll(x);
+    write_exp_golomb(bs, n - 1, 0);
+    bs->write_n_bits(x, n - 1);
+}
+
+template<class Reader>
+inline uint64_t UniversalCoder::decode_unsigned(Reader *bs) const {
+    if (code != ELIAS_DELTA) {
+        return read_exp_golomb(bs, k);
+    }
+
+    uint64_t n = read_exp_golomb(bs, 0) + 1;
+    if (n > 64) {
+        throw std::runtime_error("Invalid Elias delta code");
+    }
+    uint64_t low = 0;
+    if (n > 1) {
+        low = bs->read_n_bits(n - 1);
+        if (low == ~uint64_t(0)) {
+            throw std::runtime_error("Unexpected end of Elias delta coded stream");
+        }
+    }
+    uint64_t x = (uint64_t(1) << (n - 1)) | low;
+    return x - 1;
+}
+
+inline int UniversalCoder::length_unsigned(uint64_t u) const {
+    if (code != ELIAS_DELTA) {
+        int n = 64 - __builtin_clzll(u + (uint64_t(1) << k));
+        return 2 * n - 1 - k;
+    }
+
+    int n = 64 - __builtin_clzll(u + 1);
+    return 2 * (64 - __builtin_clzll(uint64_t(n))) - 1 + n - 1;
+}
+
+template<class Writer>
+inline void UniversalCoder::encode(Writer *bs, int num) const {
+    if (neg_handling == ZIGZAG) {
+        encode_unsigned(bs, ((uint32_t)num << 1) ^ (uint32_t)(num >> 31));
+        return;
+    }
+
+    uint32_t magnitude = num < 0 ? -(uint32_t)num : num;
+    encode_unsigned(bs, magnitude);
+    if (magnitude != 0) {
+        bs->write_bit(num < 0);
+    }
+}
+
+template<class Reader>
+inline int UniversalCoder::decode(Reader *bs) const {
+    uint64_t u = decode_unsigned(bs);
+    if (u > 0xFFFFFFFF) {
+        throw std::runtime_error("Universal coded value out of range");
+    }
+
+    if (neg_handling == ZIGZAG) {
+        return (int)(u >> 1) ^ -(int)(u & 1);
+    }
+
+    if (u == 0) {
+        return 0;
+    }
+    int sign_bit = bs->read_bit();
+    if (sign_bit == EOF) {
+        throw std::runtime_error("Unexpected end of universal coded stream");
+    }
+    return sign_bit ? (int)(0u - (uint32_t)u) : (int)u;
+}
+
+template<class Writer>
+inline void UniversalCoder::encode_block(Writer *bs, std::span<const int> values) const {
+    for (int v : values) {
+        encode(bs, v);
+    }
+}
+
+template<class Reader>
+inline void UniversalCoder::decode_block(Reader *bs, std::span<int> values) const {
+    for (int& v : values) {
+        v = decode(bs);
+    }
+}
+
+#endif
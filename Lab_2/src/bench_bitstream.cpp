@@ -0,0 +1,212 @@
+#include "GolombUtils.h"
+#include <iostream>
+#include <fstream>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+#include <functional>
+
+using namespace std;
+
+//
+// BitStream / ByteStream microbenchmark. Every case writes a stream, reads it
+// back and checks it; the best of several runs is reported as one CSV line:
+//
+//   test,param,op,bits,ns_per_bit,mb_per_s
+//
+// where bits is the size of the coded stream and MB/s refers to its bytes.
+// Streams go to memory by default, or through a file with -f.
+//
+
+struct Options {
+    size_t count = 1 << 20;   // Values (or bits, for the single-bit case) per case
+    int runs = 5;
+    string file;              // Empty: in-memory streams
+};
+
+static Options opt;
+static vector<uint8_t> mem;
+
+void print_usage(const char* prog_name) {
+    cerr << "Usage: " << prog_name << " [-n count] [-r runs] [-f tmp_file]\n\n";
+    cerr << "  -n count    - Values per case (default: " << opt.count << ")\n";
+    cerr << "  -r runs     - Runs per case, the best one is reported (default: " << opt.runs << ")\n";
+    cerr << "  -f tmp_file - Go through this file instead of memory\n";
+}
+
+double elapsed_ns(const function<void()>& f) {
+    auto start = chrono::steady_clock::now();
+    f();
+    auto end = chrono::steady_clock::now();
+    return chrono::duration<double, nano>(end - start).count();
+}
+
+// Runs a write and a read over the selected endpoint and prints the best times
+void run_case(const string& test, const string& param,
+              const function<void(BitStream&)>& writer,
+              const function<bool(BitStream&)>& reader) {
+    double best_w = 0, best_r = 0;
+    uint64_t bits = 0;
+
+    for (int r = 0; r < opt.runs; r++) {
+        double tw, tr;
+        bool ok;
+
+        if (opt.file.empty()) {
+            mem.clear();
+            tw = elapsed_ns([&] {
+                BitStream obs(mem);
+                writer(obs);
+                bits = obs.tell_bits();
+                obs.close();
+            });
+            tr = elapsed_ns([&] {
+                BitStream ibs { span<const uint8_t>(mem) };
+                ok = reader(ibs);
+            });
+        } else {
+            tw = elapsed_ns([&] {
+                fstream ofs(opt.file, ios::out | ios::binary | ios::trunc);
+                BitStream obs(ofs, STREAM_WRITE);
+                writer(obs);
+                bits = obs.tell_bits();
+                obs.close();
+            });
+            tr = elapsed_ns([&] {
+                BitStream ibs(opt.file);
+                ok = reader(ibs);
+                ibs.close();
+            });
+        }
+
+        if (!ok) {
+            cerr << "Error: " << test << " " << param << " did not read back correctly\n";
+            exit(1);
+        }
+
+        if (r == 0 || tw < best_w) best_w = tw;
+        if (r == 0 || tr < best_r) best_r = tr;
+    }
+
+    double mb = bits / 8.0 / 1e6;
+    printf("%s,%s,write,%lu,%.4f,%.2f\n", test.c_str(), param.c_str(), (unsigned long)bits,
+           best_w / bits, mb / (best_w / 1e9));
+    printf("%s,%s,read,%lu,%.4f,%.2f\n", test.c_str(), param.c_str(), (unsigned long)bits,
+           best_r / bits, mb / (best_r / 1e9));
+    fflush(stdout);
+}
+
+int main(int argc, char* argv[]) {
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "-n" && i + 1 < argc) {
+            opt.count = stoul(argv[++i]);
+        } else if (arg == "-r" && i + 1 < argc) {
+            opt.runs = stoi(argv[++i]);
+        } else if (arg == "-f" && i + 1 < argc) {
+            opt.file = argv[++i];
+        } else {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (opt.count == 0 || opt.runs <= 0) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    mt19937_64 rng(42);
+    size_t n = opt.count;
+
+    printf("test,param,op,bits,ns_per_bit,mb_per_s\n");
+
+    // Single bits
+    vector<uint8_t> bits(n);
+    for (auto& b : bits) b = rng() & 1;
+
+    run_case("bit", "1",
+        [&](BitStream& bs) {
+            for (size_t i = 0; i < n; i++) bs.write_bit(bits[i]);
+        },
+        [&](BitStream& bs) {
+            for (size_t i = 0; i < n; i++)
+                if (bs.read_bit() != bits[i]) return false;
+            return true;
+        });
+
+    // write_n_bits / read_n_bits at every width
+    vector<uint32_t> values(n), unpacked(n);
+    for (int w = 1; w <= 32; w++) {
+        uint64_t mask = (uint64_t(1) << w) - 1;
+        for (auto& v : values) v = rng() & mask;
+
+        run_case("n_bits", to_string(w),
+            [&](BitStream& bs) {
+                for (size_t i = 0; i < n; i++) bs.write_n_bits(values[i], w);
+            },
+            [&](BitStream& bs) {
+                for (size_t i = 0; i < n; i++)
+                    if (bs.read_n_bits(w) != values[i]) return false;
+                return true;
+            });
+
+        run_case("fixed", to_string(w),
+            [&](BitStream& bs) {
+                bs.pack_fixed(values.data(), n, w);
+            },
+            [&](BitStream& bs) {
+                return bs.unpack_fixed(unpacked.data(), n, w) == n && unpacked == values;
+            });
+    }
+
+    // Strings: newline-terminated lines of 1 to 80 printable characters
+    vector<string> lines(n / 40 + 1);
+    for (auto& s : lines) {
+        s.resize(1 + rng() % 80);
+        for (auto& c : s) c = ' ' + rng() % 95;
+    }
+
+    run_case("string", "1-80",
+        [&](BitStream& bs) {
+            for (const auto& s : lines) bs.write_string(s);
+        },
+        [&](BitStream& bs) {
+            for (const auto& s : lines)
+                if (bs.read_string() != s) return false;
+            return true;
+        });
+
+    // Golomb codes of two-sided geometric data whose mean magnitude suits m
+    for (int m : {1, 2, 3, 4, 5, 8, 16, 50, 64, 255, 1024, 65536}) {
+        geometric_distribution<int> geo(1.0 / (m + 1.0));
+        vector<int> data(n);
+        for (auto& v : data) v = (rng() & 1) ? geo(rng) : -geo(rng);
+
+        GolombUtils golomb(m, ZIGZAG);
+        run_case("golomb", to_string(m),
+            [&](BitStream& bs) {
+                for (size_t i = 0; i < n; i++) golomb.golomb_encode(&bs, data[i]);
+            },
+            [&](BitStream& bs) {
+                for (size_t i = 0; i < n; i++)
+                    if (golomb.golomb_decode(&bs) != data[i]) return false;
+                return true;
+            });
+
+        vector<int> decoded(n);
+        run_case("golomb_block", to_string(m),
+            [&](BitStream& bs) {
+                golomb.encode_block(&bs, data);
+            },
+            [&](BitStream& bs) {
+                golomb.decode_block(&bs, decoded);
+                return decoded == data;
+            });
+    }
+
+    if (!opt.file.empty()) remove(opt.file.c_str());
+
+    return 0;
+}
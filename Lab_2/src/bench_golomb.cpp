@@ -0,0 +1,211 @@
+#include "GolombUtils.h"
+#include <iostream>
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <random>
+#include <string>
+#include <vector>
+#include <functional>
+
+using namespace std;
+
+//
+// Golomb coder benchmark. Codes streams of random values drawn from
+// geometric (one-sided) and discrete Laplacian (two-sided, the usual model of
+// prediction residuals) distributions of several scales, with both
+// NegativeHandling methods and several m: the best m of the stream
+// (GolombCost::best_m), the best power of two and, for the widest streams,
+// m near 2^31. Every stream is checked to decode back to the same values, to
+// come out the same through golomb_encode and encode_block, and to take the
+// bits predicted by GolombCost. The best of several runs is reported as one
+// CSV line per operation:
+//
+//   dist,scale,method,m,op,symbols,bits_per_symbol,entropy,ns_per_symbol,msym_per_s
+//
+// where op is encode/decode (one value per call) or encode_block/decode_block,
+// and entropy is that of the source distribution, in bits per symbol, which
+// no code for it can beat on average.
+//
+// Both distributions have parameter theta = exp(-1 / scale):
+//   geometric  P(u) = (1 - theta) theta^u, u >= 0
+//   laplacian  P(v) = (1 - theta) / (1 + theta) theta^|v|, the difference of
+//              two independent geometric values
+// Values beyond the range of an int are drawn again, which changes nothing
+// measurable at the scales used.
+//
+
+struct Options {
+    size_t count = 1 << 20;   // Values per stream
+    int runs = 3;
+};
+
+static Options opt;
+
+void print_usage(const char* prog_name) {
+    cerr << "Usage: " << prog_name << " [-n count] [-r runs]\n\n";
+    cerr << "  -n count - Values per stream (default: " << opt.count << ")\n";
+    cerr << "  -r runs  - Runs per case, the best one is reported (default: " << opt.runs << ")\n";
+}
+
+double elapsed_ns(const function<void()>& f) {
+    auto start = chrono::steady_clock::now();
+    f();
+    auto end = chrono::steady_clock::now();
+    return chrono::duration<double, nano>(end - start).count();
+}
+
+// Geometric value of parameter theta = exp(-1 / scale), at most INT_MAX
+int64_t draw_geometric(mt19937_64& rng, double scale) {
+    uniform_real_distribution<double> uniform(0.0, 1.0);
+    for (;;) {
+        double u = floor(-scale * log(1.0 - uniform(rng)));
+        if (u <= INT_MAX) {
+            return (int64_t)u;
+        }
+    }
+}
+
+// Entropy in bits of the geometric and discrete Laplacian distributions
+double entropy_geometric(double scale) {
+    double one_minus_theta = -expm1(-1.0 / scale);
+    double mean = (1.0 - one_minus_theta) / one_minus_theta;
+    return -log2(one_minus_theta) + mean / (scale * log(2.0));
+}
+
+double entropy_laplacian(double scale) {
+    double one_minus_theta = -expm1(-1.0 / scale);
+    double theta = 1.0 - one_minus_theta;
+    double mean_magnitude = 2.0 * theta / (one_minus_theta * (1.0 + theta));
+    return -log2(one_minus_theta / (1.0 + theta)) + mean_magnitude / (scale * log(2.0));
+}
+
+void print_line(const string& dist, double scale, const char* method, int m, const char* op,
+                size_t n, uint64_t bits, double entropy, double ns) {
+    printf("%s,%g,%s,%d,%s,%lu,%.4f,%.4f,%.3f,%.2f\n", dist.c_str(), scale, method, m, op,
+           (unsigned long)n, (double)bits / n, entropy, ns / n, n / (ns / 1e3));
+    fflush(stdout);
+}
+
+// Codes the stream with m, in both ways, and prints the best times
+void run_case(const string& dist, double scale, double entropy,
+              const vector<int>& data, NegativeHandling method, int m) {
+    const char* method_name = method == ZIGZAG ? "zigzag" : "sign_magnitude";
+    size_t n = data.size();
+    vector<uint8_t> single, block;
+    vector<int> decoded(n);
+    uint64_t bits = 0, block_bits = 0;
+    double best[4] = {0, 0, 0, 0};
+
+    GolombUtils golomb(m, method);
+
+    for (int r = 0; r < opt.runs; r++) {
+        double t[4];
+
+        single.clear();
+        t[0] = elapsed_ns([&] {
+            BitStream obs(single);
+            for (size_t i = 0; i < n; i++) golomb.golomb_encode(&obs, data[i]);
+            bits = obs.tell_bits();
+            obs.close();
+        });
+
+        t[1] = elapsed_ns([&] {
+            BitStream ibs { span<const uint8_t>(single) };
+            for (size_t i = 0; i < n; i++) decoded[i] = golomb.golomb_decode(&ibs);
+        });
+        if (decoded != data) {
+            cerr << "Error: " << dist << " " << scale << " " << method_name << " m=" << m
+                 << " did not decode back correctly\n";
+            exit(1);
+        }
+
+        block.clear();
+        t[2] = elapsed_ns([&] {
+            BitStream obs(block);
+            golomb.encode_block(&obs, data);
+            block_bits = obs.tell_bits();
+            obs.close();
+        });
+
+        fill(decoded.begin(), decoded.end(), 0);
+        t[3] = elapsed_ns([&] {
+            BitStream ibs { span<const uint8_t>(block) };
+            golomb.decode_block(&ibs, decoded);
+        });
+        if (decoded != data || block != single) {
+            cerr << "Error: " << dist << " " << scale << " " << method_name << " m=" << m
+                 << " block coding differs\n";
+            exit(1);
+        }
+
+        for (int op = 0; op < 4; op++) {
+            if (r == 0 || t[op] < best[op]) best[op] = t[op];
+        }
+    }
+
+    if (bits != block_bits || bits != GolombCost(data, method).bits(m)) {
+        cerr << "Error: " << dist << " " << scale << " " << method_name << " m=" << m
+             << " took other than the predicted bits\n";
+        exit(1);
+    }
+
+    const char* ops[4] = {"encode", "decode", "encode_block", "decode_block"};
+    for (int op = 0; op < 4; op++) {
+        print_line(dist, scale, method_name, m, ops[op], n, bits, entropy, best[op]);
+    }
+}
+
+int main(int argc, char* argv[]) {
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "-n" && i + 1 < argc) {
+            opt.count = stoul(argv[++i]);
+        } else if (arg == "-r" && i + 1 < argc) {
+            opt.runs = stoi(argv[++i]);
+        } else {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (opt.count == 0 || opt.runs <= 0) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    mt19937_64 rng(42);
+    size_t n = opt.count;
+    vector<int> data(n);
+
+    printf("dist,scale,method,m,op,symbols,bits_per_symbol,entropy,ns_per_symbol,msym_per_s\n");
+
+    for (string dist : {"geometric", "laplacian"}) {
+        for (double scale : {0.5, 2.0, 8.0, 32.0, 256.0, 4096.0, 65536.0, 1048576.0, 16777216.0, 134217728.0}) {
+            double entropy;
+            if (dist == "geometric") {
+                for (auto& v : data) v = (int)draw_geometric(rng, scale);
+                entropy = entropy_geometric(scale);
+            } else {
+                for (auto& v : data) v = (int)(draw_geometric(rng, scale) - draw_geometric(rng, scale));
+                entropy = entropy_laplacian(scale);
+            }
+
+            for (NegativeHandling method : {ZIGZAG, SIGN_MAGNITUDE}) {
+                GolombCost cost(data, method);
+                vector<int> ms = {cost.best_m(), cost.best_m(true)};
+                if (scale >= 16777216.0) {
+                    ms.insert(ms.end(), {1 << 30, (1 << 30) + 1, INT_MAX});
+                }
+                sort(ms.begin(), ms.end());
+                ms.erase(unique(ms.begin(), ms.end()), ms.end());
+
+                for (int m : ms) {
+                    run_case(dist, scale, entropy, data, method, m);
+                }
+            }
+        }
+    }
+
+    return 0;
+}
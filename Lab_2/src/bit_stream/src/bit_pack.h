@@ -0,0 +1,110 @@
+//-------------------------------------------------------------------------------------------
+//
+// Copyright 2025 University of Aveiro, Portugal, All Rights Reserved.
+//
+// These programs are supplied free of charge for research purposes only,
+// and may not be sold or incorporated into any commercial product. There is
+// ABSOLUTELY NO WARRANTY of any sort, nor any undertaking that they are
+// fit for ANY PURPOSE WHATSOEVER. Use them at your own risk. If you do
+// happen to find a bug, or have modifications to suggest, please report
+// the same to Armando J. Pinho, ap@ua.pt. The copyright notice above
+// and this statement of conditions must remain an integral part of each
+// and every copy made of these files.
+//
+// Armando J. Pinho (ap@ua.pt)
+// IEETA / DETI / University of Aveiro
+//
+//-------------------------------------------------------------------------------------------
+
+#ifndef BIT_PACK_H
+#define BIT_PACK_H
+
+//
+// SIMD kernels behind pack_fixed() / unpack_fixed(), for widths up to 16
+// bits. Eight values of width w always take exactly w bytes, so a group of
+// eight keeps the bit alignment of the one before it and every group can use
+// the same shuffle and shift pattern. Selected at run time; define
+// BIT_IO_NO_SIMD to build only the scalar paths.
+//
+
+#include <cstddef>
+#include <cstdint>
+
+#if (defined(__x86_64__) or defined(__i386__)) and not defined(BIT_IO_NO_SIMD)
+#define BIT_IO_AVX2
+#include <immintrin.h>
+
+inline bool bit_io_has_avx2() {
+	static const bool has = __builtin_cpu_supports("avx2");
+	return has;
+}
+
+//
+// Packs groups of eight values into two 4w-bit chunks each, the first value
+// in the most significant bits, ready for write_n_bits(chunk, 4 * w).
+//
+__attribute__((target("avx2")))
+inline void pack8_avx2(const uint32_t* v, size_t groups, int w, uint64_t* out) {
+	const __m256i mask = _mm256_set1_epi32((1 << w) - 1);
+	const __m256i lo32 = _mm256_set1_epi64x(0xffffffff);
+	const __m128i w1 = _mm_cvtsi32_si128(w);
+	const __m128i w2 = _mm_cvtsi32_si128(2 * w);
+
+	for(size_t g = 0 ; g < groups ; g++, v += 8, out += 2) {
+		__m256i x = _mm256_and_si256(_mm256_loadu_si256((const __m256i*)v), mask);
+
+		// 64-bit lane k: (v[2k] << w) | v[2k+1]
+		x = _mm256_or_si256(_mm256_sll_epi64(_mm256_and_si256(x, lo32), w1),
+		  _mm256_srli_epi64(x, 32));
+
+		// Lanes 0 and 2: (p[0] << 2w) | p[1] and (p[2] << 2w) | p[3]
+		x = _mm256_or_si256(_mm256_sll_epi64(x, w2), _mm256_srli_si256(x, 8));
+
+		out[0] = _mm256_extract_epi64(x, 0);
+		out[1] = _mm256_extract_epi64(x, 2);
+	}
+}
+
+//
+// Unpacks up to "groups" groups of eight w-bit values starting s (0..7) bits
+// into p, without loading past p + avail. Each lane gathers the 4 bytes that
+// hold its value with one byte shuffle, then aligns it with two shifts.
+// Returns the number of groups unpacked.
+//
+__attribute__((target("avx2")))
+inline size_t unpack8_avx2(const uint8_t* p, size_t avail, int s, int w, uint32_t* v, size_t groups) {
+	int hi_off = (s + 4 * w) / 8; // Lanes 4..7 are loaded from p + hi_off
+	if(avail < size_t(hi_off + 16))
+		return 0;
+
+	size_t fit = (avail - hi_off - 16) / w + 1;
+	groups = groups < fit ? groups : fit;
+
+	alignas(32) uint8_t shuf[32];
+	alignas(32) uint32_t shift[8];
+	for(int i = 0 ; i < 8 ; i++) {
+		int bit = s + i * w;
+		int byte = bit / 8 - (i < 4 ? 0 : hi_off);
+		for(int k = 0 ; k < 4 ; k++) // Big-endian bytes into a little-endian lane
+			shuf[4 * i + k] = byte + 3 - k;
+
+		shift[i] = bit % 8;
+	}
+
+	const __m256i shuffle = _mm256_load_si256((const __m256i*)shuf);
+	const __m256i align = _mm256_load_si256((const __m256i*)shift);
+	const __m128i down = _mm_cvtsi32_si128(32 - w);
+
+	for(size_t g = 0 ; g < groups ; g++, p += w, v += 8) {
+		__m256i x = _mm256_loadu2_m128i((const __m128i*)(p + hi_off), (const __m128i*)p);
+		x = _mm256_shuffle_epi8(x, shuffle);
+		x = _mm256_srl_epi32(_mm256_sllv_epi32(x, align), down);
+		_mm256_storeu_si256((__m256i*)v, x);
+	}
+
+	return groups;
+}
+
+#endif
+
+#endif
@@ -19,25 +19,58 @@
 #ifndef BYTE_STREAM_H
 #define BYTE_STREAM_H
 
+#include <cstdio>
+#include <cstring>
 #include <fstream>
+#include <string>
+#include <vector>
+#include <span>
 #include <cstdint>
+#include <memory>
 
 const int BYTE_STREAM_BUF_SIZE = 65536;
+const int BYTE_STREAM_BUF_PAD = 8; // Zeroed bytes after the data, for word loads
 const bool STREAM_READ = true;
 const bool STREAM_WRITE = false;
+const int BYTE_STREAM_ASYNC_BUFFERS = 4; // Ring size suggested for asynchronous writes
+
+struct AsyncWriteQueue;
 
 class ByteStream {
   private:
-	uint8_t			m_buf[BYTE_STREAM_BUF_SIZE];
+	uint8_t			m_buf[BYTE_STREAM_BUF_SIZE + BYTE_STREAM_BUF_PAD];
+	uint8_t*		m_buf_start;	// Write buffer in use: m_buf, or one of the async ring
 	uint8_t*		m_buf_ptr;
-	uint8_t*		m_buf_limit;
-	int				m_size;
+	uint8_t*		m_buf_limit;	// End of the buffer (write) or of the valid data (read)
 	bool			m_rw_status { STREAM_READ };
 	off_t			m_tell { };
-	std::fstream&	m_fs;
+	std::fstream*	m_fs { };
+	std::vector<uint8_t>* m_vec { };	// Memory sink
+	int				m_fd { -1 };	// Input descriptor when not memory-mapped
+	uint8_t*		m_map { };		// Input read in place: file mapping or memory source
+	size_t			m_map_size { };
+	size_t			m_map_pos { };	// Offset of the next block in m_map
+	bool			m_mapped { };	// m_map comes from mmap and must be unmapped
+	std::unique_ptr<AsyncWriteQueue> m_async; // Background writer, if enabled
+
+	void write_block();
+	bool write_out(const uint8_t* buf, size_t n);
+	void async_loop();
+	void stop_async();
+	void put_word_slow(uint64_t w);
+
+	bool fill_from_map();
+	void release();
 
   public:
-	ByteStream(std::fstream& fs, bool rw_status);
+	// With async_buffers >= 2 (write only), full buffers are written to fs by a
+	// background thread, from a ring of that many buffers, while the caller
+	// keeps filling the next one. Write errors are then reported by close().
+	ByteStream(std::fstream& fs, bool rw_status, int async_buffers = 0);
+	ByteStream(const std::string& path); // Read only; "-" is the standard input
+	ByteStream(std::vector<uint8_t>& out); // Write only, appends to out
+	ByteStream(std::span<const uint8_t> in); // Read only, in must outlive the stream
+	~ByteStream();
 
 	ByteStream() = delete;
 	ByteStream(const ByteStream&) = delete;
@@ -46,11 +79,78 @@ class ByteStream {
 	ByteStream& operator=(const ByteStream&) = delete;
 
 	void put(int c);
+	void put_word(uint64_t w);
 	int get();
+
+	// Direct access to the read buffer. At least BYTE_STREAM_BUF_PAD bytes
+	// can always be loaded from data(); those past available() are zero.
+	const uint8_t* data() { return m_buf_ptr; }
+	size_t available() { return m_buf_limit - m_buf_ptr; }
+	void skip(size_t n) { m_buf_ptr += n; m_tell += n; }
+	bool fill();
+	bool seek(off_t pos); // Read only
+
+	// The whole input when it is read in place (a file mapping or a memory
+	// source), so that other readers can be opened on parts of it, e.g. one
+	// per thread. Empty when the input is read through a buffer.
+	std::span<const uint8_t> mapped() { return { m_map, m_map_size }; }
+
 	void flush();
+	bool is_open();
+	bool rw_status() { return m_rw_status; }
 	off_t tell();
 	void close();
 };
 
+//---------------------------------------------------------------------------------
+//
+// The per-byte and per-word calls are inline so that they are folded into the
+// bit stream; only whole-buffer transfers go out of line.
+//
+// m_buf_ptr points to the next free buffer position
+//
+inline void ByteStream::put(int c) {
+	*m_buf_ptr++ = c;
+	m_tell++;
+
+	if(m_buf_ptr == m_buf_limit) // buffer is full: write it
+		write_block();
+}
+
+//---------------------------------------------------------------------------------
+//
+// Writes the 8 bytes of w, most significant first. The bit stream only hands
+// over whole words, so the buffer fills at word boundaries and the fast path
+// never straddles the buffer limit.
+//
+inline void ByteStream::put_word(uint64_t w) {
+	if(m_buf_limit - m_buf_ptr < 8) {
+		put_word_slow(w);
+		return;
+	}
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	w = __builtin_bswap64(w);
+#endif
+	memcpy(m_buf_ptr, &w, sizeof w);
+	m_buf_ptr += 8;
+	m_tell += 8;
+
+	if(m_buf_ptr == m_buf_limit) // buffer is full: write it
+		write_block();
+}
+
+//---------------------------------------------------------------------------------
+//
+// m_buf_ptr points to the next buffer char
+//
+inline int ByteStream::get() {
+	if(m_buf_ptr == m_buf_limit and not fill()) // buffer is empty: get another block
+		return EOF;
+
+	m_tell++;
+	return *m_buf_ptr++;
+}
+
 #endif
 
@@ -3,9 +3,28 @@
 #include <fstream>
 #include <cstring>
 #include "GolombUtils.h"
+#include "RansUtils.h"
+#include "HuffmanUtils.h"
 #include <opencv2/opencv.hpp>
 using namespace std;
 
+// Width of the Golomb escape code: a residual is in [-255, 255], so its
+// zigzag mapping fits in 9 bits
+const int RESIDUAL_BITS = 9;
+
+// Values of the m header field for rANS and Huffman coded residuals (0 is
+// adaptive Golomb)
+const int M_RANS = -1;
+const int M_HUFFMAN = -2;
+
+// Name of the m header field value, for the reports
+string m_name(int m) {
+    if (m == M_RANS) return "rANS";
+    if (m == M_HUFFMAN) return "Huffman";
+    if (m == 0) return "adaptive";
+    return to_string(m);
+}
+
 cv::Vec3b predictor_jpeg_ls(int x, int y, cv::Mat image, int channel=3) {
     cv::Vec3b left_pixel, top_pixel, top_left_pixel;
 
@@ -226,16 +245,14 @@ static PredictorFunc predictors[] = {
     predictor_linear_7
 };
 
-std::ifstream::pos_type compress_image(const string& input_filename, const string& output_filename, int predictor_idx) {
+// Encodes the image into memory with the given coder ("golomb", "rans",
+// "huffman" or "auto" for the smallest of the three); returns the encoded
+// size in bytes
+long compress_image(const string& input_filename, const string& output_filename, int predictor_idx, const string& coder, vector<uint8_t>& encoded) {
     // Compression logic here
     PredictorFunc predictor = predictors[predictor_idx];
     cv::Mat image = cv::imread(input_filename);
-        fstream file(output_filename, ios::out | ios::binary | ios::trunc);
-        if (!file.is_open()) {
-            cerr << "Error: Cannot create output file\n";
-            return 1;
-        }
-        BitStream bs(file, STREAM_WRITE);
+        encoded.clear();
     
         if (image.empty()) {
             std::cerr << "Error: Could not open or find the image '" << input_filename << "'" << std::endl;
@@ -250,8 +267,7 @@ std::ifstream::pos_type compress_image(const string& input_filename, const strin
     
         std::cout << "Processing image: " << image.cols << "x" << image.rows
                 << " with " << image.channels() << " channels." << std::endl;
-        std::ifstream::pos_type file_size = 0;
-        long long total_difference = 0;
+        long file_size = 0;
         if (image.channels() == 3) {
             for (int y = 0; y < image.rows; ++y) {
                 for (int x = 0; x < image.cols; ++x) {
@@ -267,7 +283,6 @@ std::ifstream::pos_type compress_image(const string& input_filename, const strin
                     
                     for (size_t i = 0; i < 3; i++)
                     {   
-                        total_difference += abs((int)modified_pixel[i] - (int)original_pixel[i]);
                         // std::cout << (int)modified_pixel[i] - (int)original_pixel[i] << ", ";
                         modified_pixel[i] = (uchar)abs((int)modified_pixel[i] - (int)original_pixel[i]);
                     }
@@ -280,17 +295,10 @@ std::ifstream::pos_type compress_image(const string& input_filename, const strin
             }
 
             int pixel_count = image.rows * image.cols * image.channels();
-            int aprox_m = (int)((total_difference+ (pixel_count/2)) / pixel_count);
-            std::cout << "Suggested m value for Golomb coding: " << aprox_m << std::endl;
-
-            GolombUtils golomb(aprox_m, ZIGZAG);
 
-            fetch_4B_value(&bs, aprox_m); 
-            fetch_4B_value(&bs, (int)image.cols);
-            fetch_4B_value(&bs, (int)image.rows);
-            fetch_4B_value(&bs, image.type());
-            fetch_4B_value(&bs, image.channels());
-            fetch_4B_value(&bs, predictor_idx);
+            // Residuals of every channel of every pixel, coded as one block
+            vector<int> residuals;
+            residuals.reserve(pixel_count);
 
             for (int y = 0; y < image.rows; ++y) {
                 for (int x = 0; x < image.cols; ++x) {
@@ -306,7 +314,7 @@ std::ifstream::pos_type compress_image(const string& input_filename, const strin
                     
                     for (size_t i = 0; i < 3; i++)
                     {   
-                        golomb.golomb_encode(&bs,(int)modified_pixel[i] - (int)original_pixel[i]);
+                        residuals.push_back((int)modified_pixel[i] - (int)original_pixel[i]);
                     }
                     
                     //std::cout << std::endl;
@@ -316,18 +324,62 @@ std::ifstream::pos_type compress_image(const string& input_filename, const strin
                 }
             }
 
+
+            // Global m with the smallest exact code length (never 0, which
+            // marks adaptive coding)
+            int aprox_m = GolombCost(residuals, ZIGZAG, RESIDUAL_BITS).best_m();
+            std::cout << "Suggested m value for Golomb coding: " << aprox_m << std::endl;
+
+            // Code the residuals with the global m, with adaptive k (stored
+            // as m = 0), with rANS and with Huffman, and keep the smallest of
+            // those the coder allows
+            auto encode_with = [&](int m, vector<uint8_t>& out) {
+                out.clear();
+                BitStream bs(out);
+
+                fetch_4B_value(&bs, m); 
+                fetch_4B_value(&bs, (int)image.cols);
+                fetch_4B_value(&bs, (int)image.rows);
+                fetch_4B_value(&bs, image.type());
+                fetch_4B_value(&bs, image.channels());
+                fetch_4B_value(&bs, predictor_idx);
+
+                if (m == M_RANS) {
+                    RansCoder rans;
+                    rans.encode_block(&bs, residuals);
+                } else if (m == M_HUFFMAN) {
+                    HuffmanCoder huffman;
+                    huffman.encode_block(&bs, residuals);
+                } else if (m == 0) {
+                    AdaptiveGolomb adaptive(ZIGZAG, 256, RESIDUAL_BITS);
+                    adaptive.encode_block(&bs, residuals);
+                } else {
+                    GolombUtils golomb(m, ZIGZAG, RESIDUAL_BITS);
+                    golomb.encode_block(&bs, residuals);
+                }
+
+                bs.close();
+            };
+
+            vector<uint8_t> candidate;
+            int chosen_m = aprox_m;
+            for (int m : {aprox_m, 0, M_RANS, M_HUFFMAN}) {
+                if ((coder == "golomb" && m < 0) || (coder == "rans" && m != M_RANS) || (coder == "huffman" && m != M_HUFFMAN)) {
+                    continue;
+                }
+                encode_with(m, candidate);
+                if (encoded.empty() || candidate.size() < encoded.size()) {
+                    encoded.swap(candidate);
+                    chosen_m = m;
+                }
+            }
             
-            
-            bs.close();
-            
-            file.close();
-            std::filesystem::path file_path = "./" + output_filename;
             std::filesystem::path file_path2 = "./" + input_filename;
-            file_size = std::filesystem::file_size(file_path);
+            file_size = encoded.size();
             double file_size2 = (double)std::filesystem::file_size(file_path2);
             
             cout << "----------------------------\n";
-            cout<< "m : " << aprox_m << "\n";
+            cout<< "m : " << m_name(chosen_m) << "\n";
             cout << "method used : " << predictor_idx << "\n";
             cout << "Compression Ratio: " << ((double)file_size)/file_size2 << " bytes" << std::endl;
             cout<< "width : " << image.rows << "\n";
@@ -356,13 +408,12 @@ std::ifstream::pos_type compress_image(const string& input_filename, const strin
 }
 
 void decompress_image(const string& input_filename, const string& output_filename) {
-    fstream file(input_filename, ios::in | ios::binary);
+    BitStream bs(input_filename);
         
-    if (!file.is_open()) {
-            cerr << "Error: Cannot create output file\n";
+    if (!bs.is_open()) {
+            cerr << "Error: Cannot open input file\n";
             return;
         }
-        BitStream bs(file, STREAM_READ);
         
         int m = retrieve_4B_value(&bs);
         int width = retrieve_4B_value(&bs);
@@ -375,14 +426,28 @@ void decompress_image(const string& input_filename, const string& output_filenam
         
         cv::Mat image = cv::Mat(width, height, type);
         
-        cout<< "m : " << m << "\n";
+        cout<< "m : " << m_name(m) << "\n";
         cout<< "width : " << width << "\n";
         cout<< "height : " << height << "\n";
         cout<< "type : " << type << "\n";
         cout<< "channels : " << channels << "\n";
 
-        GolombUtils golomb(m, ZIGZAG);
-        
+        // The residuals do not depend on the predictions: decode them all first
+        vector<int> residuals((size_t)image.rows * image.cols * channels);
+        if (m == M_RANS) {
+            RansCoder rans;
+            rans.decode_block(&bs, residuals);
+        } else if (m == M_HUFFMAN) {
+            HuffmanCoder huffman;
+            huffman.decode_block(&bs, residuals);
+        } else if (m == 0) {
+            AdaptiveGolomb adaptive(ZIGZAG, 256, RESIDUAL_BITS);
+            adaptive.decode_block(&bs, residuals);
+        } else {
+            GolombUtils golomb(m, ZIGZAG, RESIDUAL_BITS);
+            golomb.decode_block(&bs, residuals);
+        }
+        size_t next = 0;
 
         for (int y = 0; y < image.rows; ++y) {
                 for (int x = 0; x < image.cols; ++x) {
@@ -398,7 +463,7 @@ void decompress_image(const string& input_filename, const string& output_filenam
                     
                     for (size_t i = 0; i < channels; i++)
                     {   
-                        int diff= golomb.golomb_decode(&bs);
+                        int diff= residuals[next++];
                         modified_pixel[i] = (uchar)((int)modified_pixel[i] - diff);
                     }
                     
@@ -409,7 +474,6 @@ void decompress_image(const string& input_filename, const string& output_filenam
                 }
             }
         bs.close();
-        file.close();
         bool success = cv::imwrite(output_filename, image);
         cout << "Decompressed image saved to " << output_filename << endl;
 }
@@ -419,7 +483,7 @@ int main(int argc, char* argv[]) {
     cv::Vec3b (*predictor)(int, int, cv::Mat, int) = predictors[0];
     if (argc < 4) {
         cout << "Usage:\n";
-        cout << "../bin/image_compressor <image_to_compress> compress <output_file>";
+        cout << "../bin/image_compressor <image_to_compress> compress <output_file> [golomb|rans|huffman|auto]";
 		cout << "\nOR\n";
 		cout << "../bin/image_compressor <compressed_file> decompress <output_image>";
         return 1;
@@ -437,30 +501,45 @@ int main(int argc, char* argv[]) {
     }
     
     
-    string predictor_type = "zigzag"; // Default predictor
+    string coder = "auto"; // Smallest of Golomb, rANS and Huffman
 
     if (argc > 4)
     {
-        predictor_type = argv[4];
+        coder = argv[4];
+        if (coder != "golomb" && coder != "rans" && coder != "huffman" && coder != "auto") {
+            cerr << "Error: Unknown coder '" << coder << "'. Use 'golomb', 'rans', 'huffman' or 'auto'.\n";
+            return 1;
+        }
     }
     
 
     if (operation == "compress" ) {
         cout << "compressing ...";
-        cout << "write point : "<<(int) compress_image(input_filename, output_filename, 0) << endl;
-        int s = 0;
+        // Every predictor is encoded in memory; only the smallest is written
+        vector<uint8_t> best, encoded;
         int choice = 0;
         
         for (int i = 0; i < 8; ++i) {
             cout << "Predictor " << i << ": ";
-            int t = compress_image(input_filename, output_filename, i);
-            if (s > t)
+            long t = compress_image(input_filename, output_filename, i, coder, encoded);
+            if (t < 0) {
+                return 1;
+            }
+            if (i == 0 || encoded.size() < best.size())
             {
-                s = t;
+                best.swap(encoded);
                 choice = i;
             }
         }
-        compress_image(input_filename, output_filename, choice);
+
+        fstream file(output_filename, ios::out | ios::binary | ios::trunc);
+        if (!file.is_open()) {
+            cerr << "Error: Cannot create output file\n";
+            return 1;
+        }
+        file.write((const char*)best.data(), best.size());
+        file.close();
+        cout << "Using predictor " << choice << " (" << best.size() << " bytes)" << endl;
     }
     else if (operation == "decompress")
     {   
@@ -1,14 +1,84 @@
 #include <iostream>
 #include <vector>
+#include <span>
 #include <cmath>
 #include <sndfile.hh>
 #include <fstream>
 #include <chrono>
+#include <cstring>
+#include <climits>
+#include <filesystem>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <thread>
 #include "bit_stream/src/bit_stream.h"
 #include "GolombUtils.h"
+#include "RansUtils.h"
+#include "HuffmanUtils.h"
+#include "UniversalCodes.h"
+
+// How the Golomb parameter is chosen (2-bit header field)
+enum MMode {
+    M_STATIC = 0,   // one m for the whole file
+    M_DYNAMIC = 1,  // one m per block and channel, sent before the block
+    M_ADAPTIVE = 2, // k adapted after every sample, nothing sent
+    M_CODER = 3,    // coder chosen per block and channel, see BlockCoder
+};
+
+// Coder of a block channel in M_CODER mode (CODER_BITS-bit field before it)
+enum BlockCoder {
+    CODER_GOLOMB = 0,  // m (M_FIELD_CODE), then the Golomb codes
+    CODER_RANS = 1,    // a rANS block (RansUtils.h)
+    CODER_HUFFMAN = 2, // a canonical Huffman block (HuffmanUtils.h)
+};
+const int CODER_BITS = 2;
+
+// Predictor order field of the header when the order is chosen per block and
+// channel, each then an ORDER_BITS-bit field at the start of the block
+const int ORDER_AUTO = 4;
+const int ORDER_BITS = 2;
+
+// Width of the Golomb escape code: side = L - R needs 17 bits and an order-3
+// residual of it up to 8 times more, so a mapped value always fits in 20 bits
+const int RESIDUAL_BITS = 20;
+
+// Code of the per-block Golomb m fields. An m is typically a few hundred, so
+// it costs about 17 bits rather than 32, and each block stays decodable on
+// its own.
+const UniversalCoder M_FIELD_CODE(ELIAS_DELTA);
+
+// Frames and seek table, as written by the encoder (see its definitions)
+const uint32_t FRAME_SYNC = 0xFFA5;
+const uint32_t SEEK_MAGIC = 0x57534B54; // "WSKT"
+const int SEEK_FOOTER_BYTES = 17;
 
 using namespace std;
 
+// Reads a per-block Golomb m field
+int read_m(BitStream &ibs) {
+    uint64_t m = M_FIELD_CODE.decode_unsigned(&ibs);
+    if (m == 0 || m > INT_MAX) {
+        throw runtime_error("Invalid Golomb m");
+    }
+    return (int)m;
+}
+
+// Decodes one channel of a block coded by the encoder's encode_best
+void decode_best(BitStream &ibs, RansCoder &rans, HuffmanCoder &huffman, span<int> codes, NegativeHandling method) {
+    uint64_t coder = ibs.read_n_bits(CODER_BITS);
+    if (coder == CODER_RANS) {
+        rans.decode_block(&ibs, codes);
+    } else if (coder == CODER_HUFFMAN) {
+        huffman.decode_block(&ibs, codes);
+    } else if (coder == CODER_GOLOMB) {
+        int m = read_m(ibs);
+        GolombUtils(m, method, RESIDUAL_BITS).decode_block(&ibs, codes);
+    } else {
+        throw runtime_error("Unknown block coder");
+    }
+}
+
 inline int predict_from_order(const std::vector<int> &samples, size_t idx, int order)
 {
     switch (order)
@@ -35,41 +105,425 @@ inline int predict_from_order(const std::vector<int> &samples, size_t idx, int o
     }
 }
 
+// Settings of the whole file, from its header
+struct DecoderSettings {
+    size_t total_frames = 0;
+    size_t block_size = 0;
+    int channels = 1;
+    int predictor_order = 0;
+    NegativeHandling method = ZIGZAG;
+    MMode m_mode = M_DYNAMIC;
+    int static_m_value = 1; // Also the m of the unused side coder of mono files
+
+    size_t frame_count() const {
+        return (total_frames + block_size - 1) / block_size;
+    }
+};
+
+// Coders and buffers reused by decode_frame from frame to frame
+struct BlockDecoder {
+    AdaptiveGolomb adaptive_mid;
+    AdaptiveGolomb adaptive_side;
+    RansCoder rans;
+    HuffmanCoder huffman;
+    vector<int> mid, side;
+
+    BlockDecoder(const DecoderSettings &settings)
+        : adaptive_mid(settings.method, 1 << 16, RESIDUAL_BITS),
+          adaptive_side(settings.method, 1 << 16, RESIDUAL_BITS),
+          mid(settings.block_size), side(settings.block_size) {}
+};
+
+// Entry of the seek table
+struct SeekPoint {
+    uint64_t offset;       // Byte offset of the frame in the file
+    uint64_t first_sample; // Index of its first sample
+};
+
+// Reads the entries of frames first_frame to end_frame - 1 from the seek
+// table at the end of a file of file_size bytes, checking them against the
+// header, and goes back to where ibs was. Entry i is that of frame
+// first_frame + i; a last one is added for the end of frame end_frame - 1.
+// Only the entries needed are read, so the cost does not grow with the file.
+vector<SeekPoint> read_seek_table(BitStream &ibs, uint64_t file_size, const DecoderSettings &settings,
+                                  size_t first_frame, size_t end_frame) {
+    uint64_t frames_start = ibs.tell();
+    if (file_size < frames_start + SEEK_FOOTER_BYTES || !ibs.seek_bits((file_size - SEEK_FOOTER_BYTES) * 8)) {
+        throw runtime_error("Missing seek table");
+    }
+
+    uint64_t table_offset = ibs.read_n_bits(64);
+    uint64_t entries = ibs.read_n_bits(32);
+    uint64_t offset_bytes = ibs.read_n_bits(8);
+    if (ibs.read_n_bits(32) != SEEK_MAGIC || entries != settings.frame_count() ||
+        offset_bytes < 1 || offset_bytes > 8 || table_offset < frames_start ||
+        table_offset + entries * (offset_bytes + 4) + SEEK_FOOTER_BYTES != file_size) {
+        throw runtime_error("Invalid seek table");
+    }
+
+    // With the entry of end_frame, if any, for the end of the last frame
+    vector<SeekPoint> table;
+    ibs.seek_bits((table_offset + first_frame * (offset_bytes + 4)) * 8);
+    uint64_t end = frames_start;
+    for (size_t frame = first_frame; frame < min<size_t>(end_frame + 1, entries); frame++) {
+        SeekPoint point;
+        point.offset = ibs.read_n_bits(8 * offset_bytes);
+        point.first_sample = ibs.read_n_bits(32);
+        if (point.offset < end || point.offset >= table_offset ||
+            point.first_sample != frame * settings.block_size) {
+            throw runtime_error("Invalid seek table");
+        }
+        end = point.offset + 1;
+        table.push_back(point);
+    }
+    if (end_frame == entries) {
+        table.push_back({table_offset, settings.total_frames});
+    }
+
+    ibs.seek_bits(frames_start * 8);
+    return table;
+}
+
+// Skips the zero bits up to the next byte boundary
+void skip_to_byte(BitStream &ibs) {
+    if (ibs.read_n_bits((8 - ibs.tell_bits() % 8) % 8) != 0) {
+        throw runtime_error("Invalid padding");
+    }
+}
+
+// Decodes frame number "frame", which ibs is at the start of, into
+// block_samples (interleaved). Returns its number of sample frames.
+size_t decode_frame(BitStream &ibs, BlockDecoder &dec, const DecoderSettings &settings,
+                    size_t frame, short *block_samples) {
+    int channels = settings.channels;
+    NegativeHandling method = settings.method;
+    vector<int> &mid = dec.mid, &side = dec.side;
+
+    if (ibs.read_n_bits(16) != FRAME_SYNC || ibs.read_n_bits(16) != (frame & 0xFFFF)) {
+        throw runtime_error("Invalid frame header");
+    }
+
+    int mid_order = settings.predictor_order;
+    int side_order = settings.predictor_order;
+    if (settings.predictor_order == ORDER_AUTO) {
+        mid_order = ibs.read_n_bits(ORDER_BITS);
+        if (channels == 2) {
+            side_order = ibs.read_n_bits(ORDER_BITS);
+        }
+    }
+
+    int mid_m = settings.static_m_value;
+    int side_m = settings.static_m_value;
+    if (settings.m_mode == M_DYNAMIC) {
+        mid_m = read_m(ibs);
+        if (channels == 2) {
+            side_m = read_m(ibs);
+        }
+    }
+
+    size_t frames_to_decode = min(settings.block_size, settings.total_frames - frame * settings.block_size);
+
+    // Decode each channel of the block (warmup samples, then residuals)
+    span<int> mid_codes(mid.data(), frames_to_decode);
+    span<int> side_codes(side.data(), frames_to_decode);
+
+    if (settings.m_mode == M_CODER) {
+        decode_best(ibs, dec.rans, dec.huffman, mid_codes, method);
+        if (channels == 2) {
+            decode_best(ibs, dec.rans, dec.huffman, side_codes, method);
+        }
+    } else if (settings.m_mode == M_ADAPTIVE) {
+        dec.adaptive_mid.reset();
+        dec.adaptive_mid.decode_block(&ibs, mid_codes);
+        if (channels == 2) {
+            dec.adaptive_side.reset();
+            dec.adaptive_side.decode_block(&ibs, side_codes);
+        }
+    } else {
+        GolombUtils golomb_mid(mid_m, method, RESIDUAL_BITS);
+        GolombUtils golomb_side(side_m, method, RESIDUAL_BITS);
+
+        golomb_mid.decode_block(&ibs, mid_codes);
+        if (channels == 2) {
+            golomb_side.decode_block(&ibs, side_codes);
+        }
+    }
+    skip_to_byte(ibs);
+
+    // Add the predictions to the residuals, in place, after the warmup
+    // samples of each channel
+    for (size_t i = static_cast<size_t>(mid_order); i < frames_to_decode; i++) {
+        mid[i] += predict_from_order(mid, i, mid_order);
+    }
+    if (channels == 2) {
+        for (size_t i = static_cast<size_t>(side_order); i < frames_to_decode; i++) {
+            side[i] += predict_from_order(side, i, side_order);
+        }
+    }
+
+    // Reconstruct samples
+    if (channels == 1) {
+        // Mono: mid channel is the audio
+        for (size_t i = 0; i < frames_to_decode; i++) {
+            block_samples[i] = static_cast<short>(mid[i]);
+        }
+    } else {
+        // Stereo: reconstruct L and R from mid/side
+        // Encoder: mid = (L+R)/2, side = L-R
+        for (size_t i = 0; i < frames_to_decode; i++) {
+            int m = mid[i];
+            int s = side[i];
+
+            // L = mid + (side+1)/2, R = mid - side/2
+            int L = m + ((s + 1) >> 1);
+            int R = m - (s >> 1);
+
+            block_samples[i * 2 + 0] = static_cast<short>(L);
+            block_samples[i * 2 + 1] = static_cast<short>(R);
+        }
+    }
+
+    return frames_to_decode;
+}
+
+// Writes the sample frames of a decoded frame that lie in [start, end). The
+// frame holds count sample frames from first.
+void write_range(SndfileHandle &sndFileOut, const short *block_samples, int channels,
+                 size_t first, size_t count, size_t start, size_t end) {
+    size_t from = max(first, start);
+    size_t to = min(first + count, end);
+    if (from < to) {
+        sndFileOut.writef(block_samples + (from - first) * channels, static_cast<sf_count_t>(to - from));
+    }
+}
+
+// Frames in the ring of decode_parallel per thread
+const size_t PARALLEL_RING_FRAMES = 4;
+
+// Decodes frames first_frame to end_frame - 1 with several threads, writing
+// their sample frames in [start, end). seek_table has their entries, from
+// read_seek_table. Each thread takes the next frame not yet taken and
+// decodes it, through its own reader of the frame's bytes in the input, into
+// a slot of a ring of sample buffers; this thread writes the slots out in
+// order as they are ready, and frees them for the frames that come a ring
+// later.
+void decode_parallel(span<const uint8_t> input, const vector<SeekPoint> &seek_table,
+                     size_t first_frame, size_t end_frame, size_t start, size_t end,
+                     const DecoderSettings &settings, SndfileHandle &sndFileOut, int threads) {
+    size_t frames = end_frame - first_frame;
+    size_t slots = PARALLEL_RING_FRAMES * threads;
+    size_t slot_samples = settings.block_size * settings.channels;
+    vector<short> ring(slots * slot_samples);
+    vector<size_t> slot_frames(slots); // Sample frames decoded into each slot
+    vector<char> slot_ready(slots);
+
+    mutex lock;
+    condition_variable changed;
+    size_t next_frame = 0;
+    size_t frames_written = 0;
+    exception_ptr error;
+
+    auto work = [&] {
+        BlockDecoder decoder(settings);
+        for (;;) {
+            size_t frame;
+            {
+                unique_lock<mutex> guard(lock);
+                changed.wait(guard, [&] {
+                    return error || next_frame >= frames || next_frame < frames_written + slots;
+                });
+                if (error || next_frame >= frames) {
+                    return;
+                }
+                frame = next_frame++;
+            }
+
+            size_t slot = frame % slots;
+            try {
+                uint64_t offset = seek_table[frame].offset;
+                uint64_t size = seek_table[frame + 1].offset - offset;
+                BitStream ibs{input.subspan(offset, size)};
+                slot_frames[slot] = decode_frame(ibs, decoder, settings, first_frame + frame,
+                                                 ring.data() + slot * slot_samples);
+                // The frame must take all its bytes, as when read in sequence
+                if (static_cast<uint64_t>(ibs.tell()) != size) {
+                    throw runtime_error("Frame not at its seek table offset");
+                }
+            } catch (...) {
+                lock_guard<mutex> guard(lock);
+                if (!error) {
+                    error = current_exception();
+                }
+                changed.notify_all();
+                return;
+            }
+
+            lock_guard<mutex> guard(lock);
+            slot_ready[slot] = 1;
+            changed.notify_all();
+        }
+    };
+
+    vector<thread> workers;
+    for (int t = 0; t < threads; t++) {
+        workers.emplace_back(work);
+    }
+
+    for (size_t frame = 0; frame < frames; frame++) {
+        size_t slot = frame % slots;
+        {
+            unique_lock<mutex> guard(lock);
+            changed.wait(guard, [&] { return error || slot_ready[slot]; });
+            if (error) {
+                break;
+            }
+        }
+
+        write_range(sndFileOut, ring.data() + slot * slot_samples, settings.channels,
+                    seek_table[frame].first_sample, slot_frames[slot], start, end);
+
+        lock_guard<mutex> guard(lock);
+        slot_ready[slot] = 0;
+        frames_written++;
+        changed.notify_all();
+    }
+
+    for (thread &w : workers) {
+        w.join();
+    }
+    if (error) {
+        rethrow_exception(error);
+    }
+}
+
+void print_usage(const char* prog_name) {
+    cerr << "Usage: " << prog_name << " <input bin file> <output wav file> [options]\n\n";
+    cerr << "Options:\n";
+    cerr << "  -j <threads>      Decode frames on this many threads (default: 1)\n";
+    cerr << "  --start <pos>     First sample to decode (default: the first)\n";
+    cerr << "  --end <pos>       Sample to stop before (default: the end)\n";
+    cerr << "                    Positions are sample numbers, or seconds with an\n";
+    cerr << "                    's' suffix (e.g. 90s, 12.5s)\n";
+}
+
+// Position of a --start/--end argument, in samples: a sample number, or
+// seconds with an "s" suffix. Returns false if it is not a valid position.
+bool parse_position(const string &arg, int samplerate, size_t &pos) {
+    try {
+        size_t used;
+        if (!arg.empty() && arg.back() == 's') {
+            double seconds = stod(arg.substr(0, arg.size() - 1), &used);
+            if (used != arg.size() - 1 || !(seconds >= 0) || seconds * samplerate > 1e18) {
+                return false;
+            }
+            pos = static_cast<size_t>(llround(seconds * samplerate));
+        } else {
+            if (arg.empty() || arg[0] == '-') {
+                return false;
+            }
+            pos = stoull(arg, &used);
+            if (used != arg.size()) {
+                return false;
+            }
+        }
+    } catch (...) {
+        return false;
+    }
+    return true;
+}
+
 int main(int argc, char *argv[]) {
     auto start_time = chrono::high_resolution_clock::now();
 
     if (argc < 3) {
-        cerr << "Usage: " << argv[0] << " <input bin file> <output wav file>\n";
+        print_usage(argv[0]);
         return 1;
     }
 
-    fstream ifs{argv[1], ios::in | ios::binary};
-    if (!ifs.is_open()) {
+    int threads = 1;
+    string start_arg, end_arg;
+    for (int i = 3; i < argc; i++) {
+        if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            try {
+                threads = stoi(argv[++i]);
+            } catch (...) {
+                threads = 0;
+            }
+            if (threads <= 0) {
+                cerr << "Error: number of threads must be positive\n";
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--start") == 0 && i + 1 < argc) {
+            start_arg = argv[++i];
+        } else if (strcmp(argv[i], "--end") == 0 && i + 1 < argc) {
+            end_arg = argv[++i];
+        } else {
+            cerr << "Error: Unknown option '" << argv[i] << "'\n";
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    // Memory-mapped input; "-" reads from the standard input
+    string input_file = argv[1];
+    BitStream ibs{input_file};
+    if (!ibs.is_open()) {
         cerr << "Cannot open input file\n";
         return 1;
     }
 
-    BitStream ibs{ifs, STREAM_READ};
-
     // Read header
+    DecoderSettings settings;
     int samplerate = ibs.read_n_bits(32);
-    size_t total_frames = static_cast<size_t>(ibs.read_n_bits(32));
-    size_t BLOCK_SIZE = static_cast<size_t>(ibs.read_n_bits(16));
-    int channels = ibs.read_n_bits(8);
-    int predictor_order = ibs.read_n_bits(8);
-    NegativeHandling method = static_cast<NegativeHandling>(ibs.read_n_bits(8));
-    bool use_dynamic_m = ibs.read_n_bits(1) == 1;
-
-    uint32_t static_m_value = 0;
-    if (!use_dynamic_m) {
+    settings.total_frames = static_cast<size_t>(ibs.read_n_bits(32));
+    settings.block_size = static_cast<size_t>(ibs.read_n_bits(16));
+    settings.channels = ibs.read_n_bits(8);
+    settings.predictor_order = ibs.read_n_bits(8);
+    settings.method = static_cast<NegativeHandling>(ibs.read_n_bits(8));
+    settings.m_mode = static_cast<MMode>(ibs.read_n_bits(2));
+
+    uint64_t static_m_value = 1;
+    if (settings.m_mode == M_STATIC) {
         static_m_value = ibs.read_n_bits(32);
     }
+    settings.static_m_value = static_cast<int>(static_m_value);
+
+    if (settings.m_mode > M_CODER || (settings.method != ZIGZAG && settings.method != SIGN_MAGNITUDE)) {
+        cerr << "Unknown Golomb parameter mode or negative handling method\n";
+        return 1;
+    }
 
+    if (settings.predictor_order > ORDER_AUTO) {
+        cerr << "Unknown predictor order\n";
+        return 1;
+    }
+
+    if (settings.block_size == 0 || static_m_value == 0 || static_m_value > INT_MAX) {
+        cerr << "Invalid block size or static m\n";
+        return 1;
+    }
+
+    int channels = settings.channels;
     if (channels !=1 && channels != 2) {
         cerr << "Only mono (1 channel) or stereo (2 channels) supported\n";
         return 1;
     }
 
+    // Sample frames to decode, [start, end), and the frames that hold them
+    size_t start = 0, end = settings.total_frames;
+    if ((!start_arg.empty() && !parse_position(start_arg, samplerate, start)) ||
+        (!end_arg.empty() && !parse_position(end_arg, samplerate, end))) {
+        cerr << "Error: invalid --start or --end position\n";
+        return 1;
+    }
+    end = min(end, settings.total_frames);
+    if (start >= end && settings.total_frames != 0) {
+        cerr << "Error: empty range (the file has " << settings.total_frames << " samples)\n";
+        return 1;
+    }
+    size_t first_frame = start / settings.block_size;
+    size_t end_frame = (end + settings.block_size - 1) / settings.block_size;
+
     // Create output WAV file
     SndfileHandle sndFileOut(argv[2], SFM_WRITE, SF_FORMAT_WAV | SF_FORMAT_PCM_16, channels, samplerate);
     if (sndFileOut.error()) {
@@ -77,88 +531,42 @@ int main(int argc, char *argv[]) {
         return 1;
     }
 
-    vector<short> block_samples(BLOCK_SIZE * channels);
-    vector<int> mid(BLOCK_SIZE);
-    vector<int> side(BLOCK_SIZE);
-
-    size_t frames_written = 0;
-    int mid_m, side_m;
-
-    mid_m = static_m_value;
-    side_m = static_m_value;
+    vector<short> block_samples(settings.block_size * channels);
+    BlockDecoder decoder(settings);
 
     try {
-        while (frames_written < total_frames) {
-
-            if (use_dynamic_m) {
-                mid_m = ibs.read_n_bits(32);
-                if(mid_m == EOF) break;
-                if(channels == 2){
-                    side_m = ibs.read_n_bits(32);
-                    if(side_m == EOF) break;
-                }
-            }
-
-            GolombUtils golomb_mid(mid_m, method);
-            GolombUtils golomb_side(side_m, method);
+        skip_to_byte(ibs);
 
-            size_t frames_to_decode = BLOCK_SIZE;
-            if (frames_written + BLOCK_SIZE > total_frames) {
-                frames_to_decode = total_frames - frames_written;
-            }
-
-            // Determine warmup
-            size_t warmup = static_cast<size_t>(predictor_order);
-            if (warmup > frames_to_decode) warmup = frames_to_decode;
-
-            // Decode warmup samples
-            for (size_t i = 0; i < warmup; i++) {
-                mid[i] = golomb_mid.golomb_decode(&ibs);
-                if (channels == 2) {
-                    side[i] = golomb_side.golomb_decode(&ibs);
-                }
-            }
-
-            // Decode remaining samples as residuals and reconstruct
-            for (size_t i = warmup; i < frames_to_decode; i++) {
-                int predicted_mid = predict_from_order(mid, i, predictor_order);
-                int residual_mid = golomb_mid.golomb_decode(&ibs);
-                mid[i] = predicted_mid + residual_mid;
+        // The seek table entries of the frames to decode, to go to the
+        // first one, to check that every frame is where it says and to find
+        // the frames of each thread. The standard input cannot seek: it is
+        // decoded from the start, and only the range is written.
+        vector<SeekPoint> seek_table;
+        if (input_file != "-") {
+            seek_table = read_seek_table(ibs, filesystem::file_size(input_file), settings, first_frame, end_frame);
+        } else {
+            first_frame = 0;
+        }
 
-                if (channels == 2) {
-                    int predicted_side = predict_from_order(side, i, predictor_order);
-                    int residual_side = golomb_side.golomb_decode(&ibs);
-                    side[i] = predicted_side + residual_side;
-                }
+        // Several threads need the seek table and the input in memory
+        if (threads > 1 && !seek_table.empty() && !ibs.mapped().empty()) {
+            decode_parallel(ibs.mapped(), seek_table, first_frame, end_frame, start, end,
+                            settings, sndFileOut, threads);
+        } else {
+            if (!seek_table.empty() && !ibs.seek_bits(seek_table[0].offset * 8)) {
+                throw runtime_error("Cannot seek to the first frame");
             }
 
-            // Reconstruct samples
-            if (channels == 1) {
-                // Mono: mid channel is the audio
-                for (size_t i = 0; i < frames_to_decode; i++) {
-                    block_samples[i] = static_cast<short>(mid[i]);
+            // Each frame must end where the next one starts, as with several
+            // threads, which read each frame on its own
+            for (size_t frame = first_frame; frame < end_frame; frame++) {
+                size_t frames_decoded = decode_frame(ibs, decoder, settings, frame, block_samples.data());
+                if (!seek_table.empty() && static_cast<uint64_t>(ibs.tell()) != seek_table[frame - first_frame + 1].offset) {
+                    throw runtime_error("Frame not at its seek table offset");
                 }
-            } else {
-                // Stereo: reconstruct L and R from mid/side
-                // Encoder: mid = (L+R)/2, side = L-R
-                for (size_t i = 0; i < frames_to_decode; i++) {
-                    int m = mid[i];
-                    int s = side[i];
-
-                    // L = mid + (side+1)/2, R = mid - side/2
-                    int L = m + ((s + 1) >> 1);
-                    int R = m - (s >> 1);
-
-                    block_samples[i * 2 + 0] = static_cast<short>(L);
-                    block_samples[i * 2 + 1] = static_cast<short>(R);
-                }
-            }
 
-            sndFileOut.writef(block_samples.data(), static_cast<sf_count_t>(frames_to_decode));
-            frames_written += frames_to_decode;
-
-            if (frames_written >= total_frames) {
-                break;
+                write_range(sndFileOut, block_samples.data(), channels, frame * settings.block_size,
+                            frames_decoded, start, end);
             }
         }
     } catch (...) {
@@ -166,7 +574,7 @@ int main(int argc, char *argv[]) {
         return 1;
     }
 
-    ifs.close();
+    ibs.close();
 
     auto end_time = chrono::high_resolution_clock::now();
     auto duration = chrono::duration_cast<chrono::milliseconds>(end_time - start_time);
@@ -1,32 +1,121 @@
 #include <iostream>
 #include <vector>
+#include <span>
 #include <cmath>
 #include <sndfile.hh>
-#include <numeric>
 #include <fstream>
 #include <cstring>
 #include <chrono>
+#include <atomic>
+#include <exception>
+#include <thread>
 #include "bit_stream/src/bit_stream.h"
 #include "GolombUtils.h"
+#include "RansUtils.h"
+#include "HuffmanUtils.h"
+#include "UniversalCodes.h"
 
 enum PredictionMode {
     order0 = 0,
     order1 = 1,
     order2 = 2,
     order3 = 3,
+    order_auto = 4, // chosen per block and channel, see ORDER_BITS
 };
 
+// Predictor order of a block channel in order_auto mode (ORDER_BITS-bit
+// fields at the start of the block, mid then side)
+const int ORDER_BITS = 2;
+
+// How the Golomb parameter is chosen (2-bit header field)
+enum MMode {
+    M_STATIC = 0,   // one m for the whole file
+    M_DYNAMIC = 1,  // one m per block and channel, sent before the block
+    M_ADAPTIVE = 2, // k adapted after every sample, nothing sent
+    M_CODER = 3,    // coder chosen per block and channel, see BlockCoder
+};
+
+// Coder of a block channel in M_CODER mode (CODER_BITS-bit field before it)
+enum BlockCoder {
+    CODER_GOLOMB = 0,  // m (M_FIELD_CODE), then the Golomb codes
+    CODER_RANS = 1,    // a rANS block (RansUtils.h)
+    CODER_HUFFMAN = 2, // a canonical Huffman block (HuffmanUtils.h)
+};
+const int CODER_BITS = 2;
+
+// Width of the Golomb escape code: side = L - R needs 17 bits and an order-3
+// residual of it up to 8 times more, so a mapped value always fits in 20 bits
+const int RESIDUAL_BITS = 20;
+
+// Code of the per-block Golomb m fields. An m is typically a few hundred, so
+// it costs about 17 bits rather than 32, and each block stays decodable on
+// its own.
+const UniversalCoder M_FIELD_CODE(ELIAS_DELTA);
+
+// Frames: each block starts on a byte boundary with a header of FRAME_SYNC
+// (16 bits) and the low 16 bits of its index, and is padded with zero bits
+// to the next byte.
+const uint32_t FRAME_SYNC = 0xFFA5;
+
+// Seek table, after the last frame: for each frame its byte offset in the
+// file (offset_bytes bytes) and the index of its first sample (32 bits).
+// Then a footer of SEEK_FOOTER_BYTES bytes, the last of the file: the offset
+// of the table (64 bits), its number of entries (32 bits), offset_bytes
+// (8 bits) and SEEK_MAGIC (32 bits).
+const uint32_t SEEK_MAGIC = 0x57534B54; // "WSKT"
+const int SEEK_FOOTER_BYTES = 17;
+
 using namespace std;
 
-double mean_abs(const std::vector<int> &values, size_t nFrames) {
-    if (values.empty())
-        return 0.0;
-    double sum_abs = std::accumulate(values.begin(), values.end(), 0.0,
-                                     [](double acc, int v)
-                                     {
-                                         return acc + std::abs(static_cast<double>(v));
-                                     });
-    return sum_abs / static_cast<double>(nFrames);
+// Coders tried on each block in M_CODER mode besides Golomb, and buffers for
+// their output
+struct BlockCoders {
+    bool use_rans = false;
+    bool use_huffman = false;
+    RansCoder rans;
+    HuffmanCoder huffman;
+    vector<uint8_t> buffer;
+    vector<uint8_t> best;
+};
+
+// Codes one channel of a block with whichever of Golomb (at its best m) and
+// the enabled coders is smaller. The other coders code the block into memory
+// first, so their exact size is known, and the smallest is then copied to
+// the output.
+void encode_best(BitStream &obs, BlockCoders &coders, span<const int> codes, NegativeHandling method) {
+    GolombCost cost(codes, method, RESIDUAL_BITS);
+    uint32_t m = cost.best_m();
+    uint64_t best_bits = M_FIELD_CODE.length_unsigned(m) + cost.bits(m);
+    BlockCoder best_coder = CODER_GOLOMB;
+
+    auto try_coder = [&](BlockCoder coder, auto &c) {
+        coders.buffer.clear();
+        BitStream mem{coders.buffer};
+        c.encode_block(&mem, codes);
+        uint64_t bits = mem.tell_bits();
+        mem.close();
+
+        if (bits < best_bits) {
+            best_bits = bits;
+            best_coder = coder;
+            coders.best.swap(coders.buffer);
+        }
+    };
+
+    if (coders.use_rans) {
+        try_coder(CODER_RANS, coders.rans);
+    }
+    if (coders.use_huffman) {
+        try_coder(CODER_HUFFMAN, coders.huffman);
+    }
+
+    obs.write_n_bits(best_coder, CODER_BITS);
+    if (best_coder == CODER_GOLOMB) {
+        M_FIELD_CODE.encode_unsigned(&obs, m);
+        GolombUtils(m, method, RESIDUAL_BITS).encode_block(&obs, codes);
+    } else {
+        obs.write_bytes(coders.best, best_bits);
+    }
 }
 
 inline int floor_div2(int x) {
@@ -61,8 +150,256 @@ inline int predict_from_order(const std::vector<int> &samples, size_t idx, int o
     }
 }
 
+// Fixed predictor order (0 to 3) with the smallest sum of absolute
+// residuals over the samples, a close estimate of the cheapest to code. The
+// residuals of every order are computed together, each from the one before
+// (e3 = e2 - previous e2 ...), and summed per chunk in 32 bits (at most
+// 2^20 each), so the loop vectorizes. The first three samples, a warmup for
+// some orders, are left out.
+int best_predictor_order(span<const int> samples) {
+    const size_t CHUNK = 1 << 11;
+    uint64_t total[4] = {0, 0, 0, 0};
+
+    for (size_t base = 3; base < samples.size(); base += CHUNK) {
+        const int *x = samples.data();
+        size_t end = min(base + CHUNK, samples.size());
+        uint32_t sum0 = 0, sum1 = 0, sum2 = 0, sum3 = 0;
+
+        for (size_t i = base; i < end; i++) {
+            int e0 = x[i];
+            int e1 = e0 - x[i - 1];
+            int e2 = e1 - (x[i - 1] - x[i - 2]);
+            int e3 = e2 - (x[i - 1] - 2 * x[i - 2] + x[i - 3]);
+            sum0 += abs(e0);
+            sum1 += abs(e1);
+            sum2 += abs(e2);
+            sum3 += abs(e3);
+        }
+
+        total[0] += sum0;
+        total[1] += sum1;
+        total[2] += sum2;
+        total[3] += sum3;
+    }
+
+    // The lowest order of the smallest sums
+    return (int)(min_element(total, total + 4) - total);
+}
+
+// Values to code for one channel of a block: the first order samples as they
+// are (fewer if the block is shorter), then the residuals of the prediction
+void predict_block(const vector<int> &samples, vector<int> &codes, int order) {
+    size_t warmup = min(static_cast<size_t>(order), samples.size());
+
+    codes.resize(samples.size());
+    for (size_t i = 0; i < warmup; ++i) {
+        codes[i] = samples[i];
+    }
+    for (size_t i = warmup; i < samples.size(); ++i) {
+        codes[i] = samples[i] - predict_from_order(samples, i, order);
+    }
+}
+
 size_t BLOCK_SIZE = 1024;
 
+// Settings of the whole file, as sent in its header
+struct EncoderSettings {
+    int channels = 1;
+    int predictor_order = 1;
+    NegativeHandling method = ZIGZAG;
+    MMode m_mode = M_DYNAMIC;
+    bool rice_only = false;
+    uint32_t static_m_value = 1;
+};
+
+// Coders and buffers reused by encode_block from block to block. Blocks are
+// coded independently, so each thread has its own.
+struct BlockEncoder {
+    BlockCoders coders;
+    AdaptiveGolomb adaptive_mid;
+    AdaptiveGolomb adaptive_side;
+    vector<int> mid, side;
+    vector<int> mid_codes, side_codes;
+
+    BlockEncoder(const EncoderSettings &settings, const BlockCoders &coders_value)
+        : coders(coders_value),
+          adaptive_mid(settings.method, 1 << 16, RESIDUAL_BITS),
+          adaptive_side(settings.method, 1 << 16, RESIDUAL_BITS) {}
+};
+
+// Codes one block of nFrames frames (interleaved samples)
+void encode_block(BitStream &obs, BlockEncoder &enc, const EncoderSettings &settings,
+                  const short *block_samples, size_t nFrames) {
+    int channels = settings.channels;
+    NegativeHandling method = settings.method;
+    vector<int> &mid = enc.mid, &side = enc.side;
+
+    mid.resize(nFrames);
+    side.resize(nFrames);
+
+    if (channels == 1) {
+        // Mono use only mid
+        for (size_t i = 0; i < nFrames; ++i) {
+            mid[i] = static_cast<int>(block_samples[i]);
+            side[i] = 0; // not used for mono
+        }
+    } else {
+        // Stereo convert to mid/side
+        for (size_t i = 0; i < nFrames; ++i) {
+            int L = static_cast<int>(block_samples[i * channels + 0]);
+            int R = static_cast<int>(block_samples[i * channels + 1]);
+
+            // mid = (L + R) / 2 (integer division, truncates toward zero)
+            mid[i] = floor_div2(L + R);
+
+            // side = L - R
+            side[i] = L - R;
+        }
+    }
+
+    // Predictor order of each channel, sent first if chosen per block
+    int mid_order = settings.predictor_order;
+    int side_order = settings.predictor_order;
+    if (settings.predictor_order == order_auto) {
+        mid_order = best_predictor_order(mid);
+        obs.write_n_bits(mid_order, ORDER_BITS);
+        if (channels == 2) {
+            side_order = best_predictor_order(side);
+            obs.write_n_bits(side_order, ORDER_BITS);
+        }
+    }
+
+    // Values to code per channel: the warmup samples, then the residuals
+    vector<int> &mid_codes = enc.mid_codes, &side_codes = enc.side_codes;
+    predict_block(mid, mid_codes, mid_order);
+    if (channels == 2) {
+        predict_block(side, side_codes, side_order);
+    } else {
+        side_codes.assign(nFrames, 0);
+    }
+
+    if (settings.m_mode == M_CODER) {
+        encode_best(obs, enc.coders, mid_codes, method);
+        if (channels == 2) {
+            encode_best(obs, enc.coders, side_codes, method);
+        }
+        return;
+    }
+
+    if (settings.m_mode == M_ADAPTIVE) {
+        enc.adaptive_mid.reset();
+        enc.adaptive_mid.encode_block(&obs, mid_codes);
+        if (channels == 2) {
+            enc.adaptive_side.reset();
+            enc.adaptive_side.encode_block(&obs, side_codes);
+        }
+        return;
+    }
+
+    uint32_t mid_m, side_m;
+    mid_m = settings.static_m_value;
+    side_m = settings.static_m_value;
+
+    if (settings.m_mode == M_DYNAMIC) {
+        // m with the smallest exact code length for the block
+        mid_m = GolombCost(mid_codes, method, RESIDUAL_BITS).best_m(settings.rice_only);
+
+        // write mid m
+        M_FIELD_CODE.encode_unsigned(&obs, mid_m);
+
+        if (channels == 2) {
+            side_m = GolombCost(side_codes, method, RESIDUAL_BITS).best_m(settings.rice_only);
+
+            // write side m
+            M_FIELD_CODE.encode_unsigned(&obs, side_m);
+        }
+    }
+
+    GolombUtils golomb_mid(mid_m, method, RESIDUAL_BITS);
+    GolombUtils golomb_side(side_m, method, RESIDUAL_BITS);
+
+    // Each channel of the block is coded as one run
+    golomb_mid.encode_block(&obs, mid_codes);
+    if (channels == 2) {
+        golomb_side.encode_block(&obs, side_codes);
+    }
+}
+
+// Zero bits up to the next byte boundary
+void pad_to_byte(BitStream &obs) {
+    obs.write_n_bits(0, (8 - obs.tell_bits() % 8) % 8);
+}
+
+// Codes block number "frame" as a frame. obs must be at a byte boundary.
+void encode_frame(BitStream &obs, BlockEncoder &enc, const EncoderSettings &settings,
+                  size_t frame, const short *block_samples, size_t nFrames) {
+    obs.write_n_bits(FRAME_SYNC, 16);
+    obs.write_n_bits(frame & 0xFFFF, 16);
+    encode_block(obs, enc, settings, block_samples, nFrames);
+    pad_to_byte(obs);
+}
+
+// Blocks read at a time per thread by encode_parallel
+const size_t PARALLEL_RUN_BLOCKS = 16;
+
+// Codes the frames with several threads, adding their offsets to
+// frame_offsets. A run of blocks is read, the threads code them into memory
+// (each taking the next block not yet taken) and the frames are then copied
+// to the output in order, so the output is the same as with one thread.
+void encode_parallel(BitStream &obs, SndfileHandle &sndFile, const EncoderSettings &settings,
+                     const BlockCoders &coders, int threads, vector<uint64_t> &frame_offsets) {
+    int channels = settings.channels;
+    size_t run_blocks = PARALLEL_RUN_BLOCKS * threads;
+    vector<short> run_samples(run_blocks * BLOCK_SIZE * channels);
+    vector<vector<uint8_t>> coded(run_blocks);
+    vector<uint64_t> coded_bits(run_blocks);
+    vector<BlockEncoder> encoders(threads, BlockEncoder(settings, coders));
+
+    size_t nFrames;
+    while ((nFrames = sndFile.readf(run_samples.data(), static_cast<sf_count_t>(run_blocks * BLOCK_SIZE)))) {
+        size_t blocks = (nFrames + BLOCK_SIZE - 1) / BLOCK_SIZE;
+        atomic<size_t> next_block{0};
+        exception_ptr error;
+        atomic<bool> failed{false};
+
+        auto work = [&](int t) {
+            try {
+                for (size_t b; (b = next_block++) < blocks; ) {
+                    size_t first = b * BLOCK_SIZE;
+                    coded[b].clear();
+                    BitStream mem{coded[b]};
+                    encode_frame(mem, encoders[t], settings, frame_offsets.size() + b,
+                                 run_samples.data() + first * channels, min(BLOCK_SIZE, nFrames - first));
+                    coded_bits[b] = mem.tell_bits();
+                    mem.close();
+                }
+            } catch (...) {
+                if (!failed.exchange(true)) {
+                    error = current_exception();
+                }
+            }
+        };
+
+        // This thread is one of the workers
+        vector<thread> workers;
+        for (int t = 1; t < threads; t++) {
+            workers.emplace_back(work, t);
+        }
+        work(0);
+        for (thread &w : workers) {
+            w.join();
+        }
+        if (error) {
+            rethrow_exception(error);
+        }
+
+        for (size_t b = 0; b < blocks; b++) {
+            frame_offsets.push_back(obs.tell());
+            obs.write_bytes(coded[b], coded_bits[b]);
+        }
+    }
+}
+
 void print_usage(const char* prog_name) {
     cout << "Usage: " << prog_name << " <input.wav> <output.bin> [options]\n\n";
     cout << "Required:\n";
@@ -70,17 +407,34 @@ void print_usage(const char* prog_name) {
     cout << "  <output.bin>      Output binary file\n\n";
     cout << "Options:\n";
     cout << "  -b <block_size>   Block size for encoding (default: 1024)\n";
-    cout << "  -p <order>        Predictor order 0-3 (default: 1)\n";
+    cout << "  -p <order>        Predictor order 0-3, or 'auto' for the best per block\n";
+    cout << "                    and channel (default: 1)\n";
     cout << "  -m <method>       Negative handling method:\n";
     cout << "                    'zigzag', 'sign_magnitude'\n";
     cout << "                    (default: zigzag)\n";
     cout << "  -gd               Use dynamic Golomb m (default)\n";
-    cout << "  -gs <m_value>     Use static Golomb m value\n\n";
+    cout << "  -gs <m_value>     Use static Golomb m value\n";
+    cout << "  -gr               Use dynamic m restricted to powers of two\n";
+    cout << "                    (Rice codes: faster, slightly larger output)\n";
+    cout << "  -ga               Adapt the Rice parameter after every sample\n";
+    cout << "                    (LOCO-I style, no per-block m)\n";
+    cout << "  -rans             Code each block with rANS, or Golomb where smaller\n";
+    cout << "  -huffman          Code each block with canonical Huffman, or Golomb\n";
+    cout << "                    where smaller (with -rans, the smallest of the three)\n";
+    cout << "                    Of -gd, -gs, -gr, -ga and -rans/-huffman, the last given is used\n";
+    cout << "  -a                Write the output from a background thread\n";
+    cout << "  -j <threads>      Code blocks on this many threads (default: 1,\n";
+    cout << "                    same output with any number)\n\n";
     cout << "Examples:\n";
     cout << "  " << prog_name << " input.wav output.bin\n";
     cout << "  " << prog_name << " input.wav output.bin -b 2048 -p 2\n";
     cout << "  " << prog_name << " input.wav output.bin -m sign_magnitude\n";
     cout << "  " << prog_name << " input.wav output.bin -gs 8\n";
+    cout << "  " << prog_name << " input.wav output.bin -gr\n";
+    cout << "  " << prog_name << " input.wav output.bin -ga\n";
+    cout << "  " << prog_name << " input.wav output.bin -rans\n";
+    cout << "  " << prog_name << " input.wav output.bin -rans -huffman\n";
+    cout << "  " << prog_name << " input.wav output.bin -j 8\n";
 }
 
 
@@ -97,15 +451,20 @@ int main(int argc, char *argv[]) {
     int predictor_order = 1;
     NegativeHandling method = ZIGZAG; // default
     bool use_dynamic_m = true; // default to dynamic
+    bool rice_only = false;
+    bool use_adaptive = false;
+    BlockCoders coders;
     uint32_t static_m_value = 1;
+    bool async_writes = false;
+    int threads = 1;
 
     // Parse optional arguments starting from argv[3]
     for (int i = 3; i < argc; i++) {
         if (strcmp(argv[i], "-b") == 0 && i + 1 < argc) {
             try {
                 long bs = stol(argv[++i]);
-                if (bs <= 0) {
-                    cerr << "Error: block size must be positive\n";
+                if (bs <= 0 || bs > 65535) {
+                    cerr << "Error: block size must be between 1 and 65535\n";
                     return 1;
                 }
                 BLOCK_SIZE = static_cast<size_t>(bs);
@@ -113,6 +472,9 @@ int main(int argc, char *argv[]) {
                 cerr << "Error: invalid block size\n";
                 return 1;
             }
+        } else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc && strcmp(argv[i + 1], "auto") == 0) {
+            predictor_order = order_auto;
+            i++;
         } else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
             try {
                 int po = stoi(argv[++i]);
@@ -129,6 +491,26 @@ int main(int argc, char *argv[]) {
             method = parse_method(argv[++i]);
         } else if (strcmp(argv[i], "-gd") == 0) {
             use_dynamic_m = true;
+            rice_only = false;
+            use_adaptive = false;
+            coders.use_rans = coders.use_huffman = false;
+        } else if (strcmp(argv[i], "-gr") == 0) {
+            use_dynamic_m = true;
+            rice_only = true;
+            use_adaptive = false;
+            coders.use_rans = coders.use_huffman = false;
+        } else if (strcmp(argv[i], "-ga") == 0) {
+            use_dynamic_m = false;
+            use_adaptive = true;
+            coders.use_rans = coders.use_huffman = false;
+        } else if (strcmp(argv[i], "-rans") == 0) {
+            use_dynamic_m = false;
+            use_adaptive = false;
+            coders.use_rans = true;
+        } else if (strcmp(argv[i], "-huffman") == 0) {
+            use_dynamic_m = false;
+            use_adaptive = false;
+            coders.use_huffman = true;
         } else if (strcmp(argv[i], "-gs") == 0 && i + 1 < argc) {
             try {
                 int m = stoi(argv[++i]);
@@ -138,16 +520,32 @@ int main(int argc, char *argv[]) {
                 }
                 static_m_value = static_cast<uint32_t>(m);
                 use_dynamic_m = false;
+                use_adaptive = false;
+                coders.use_rans = coders.use_huffman = false;
             } catch (...) {
                 cerr << "Error: invalid static m value\n";
                 return 1;
             }
+        } else if (strcmp(argv[i], "-a") == 0) {
+            async_writes = true;
+        } else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            try {
+                threads = stoi(argv[++i]);
+                if (threads <= 0) {
+                    cerr << "Error: number of threads must be positive\n";
+                    return 1;
+                }
+            } catch (...) {
+                cerr << "Error: invalid number of threads\n";
+                return 1;
+            }
         } else {
             cerr << "Error: Unknown option '" << argv[i] << "'\n";
             print_usage(argv[0]);
             return 1;
         }
     }
+    bool use_coders = coders.use_rans || coders.use_huffman;
 
     SndfileHandle sndFile{input_file.c_str()};
     if (sndFile.error()) {
@@ -175,13 +573,15 @@ int main(int argc, char *argv[]) {
         return 1;
     }
 
-    BitStream obs{ofs, STREAM_WRITE};
+    // Optionally overlap disk writes with encoding through a ring of buffers
+    BitStream obs{ofs, STREAM_WRITE, async_writes ? BYTE_STREAM_ASYNC_BUFFERS : 0};
 
     cout << "Encoding parameters:\n";
     cout << "  Block size: " << BLOCK_SIZE << "\n";
-    cout << "  Predictor order: " << predictor_order << "\n";
+    cout << "  Predictor order: " << (predictor_order == order_auto ? "auto" : to_string(predictor_order)) << "\n";
     cout << "  Negative handling method: " << (method == ZIGZAG ? "zigzag" : "sign_magnitude") << "\n";
-    cout << "  Golomb m: " << (use_dynamic_m ? "dynamic" : to_string(static_m_value)) << "\n";
+    cout << "  Threads: " << threads << "\n";
+    cout << "  Golomb m: " << (use_coders ? "per block (Golomb, or another coder where smaller)" : use_adaptive ? "adaptive" : use_dynamic_m ? (rice_only ? "dynamic (Rice)" : "dynamic") : to_string(static_m_value)) << "\n";
     cout << "\n";
     cout << "Encoding " << input_file << " to " << output_file << "\n";
     cout << "  Sample rate: " << sndFile.samplerate() << "\n";
@@ -194,7 +594,7 @@ int main(int argc, char *argv[]) {
     //    debug_file << "block,sample,mid_residual,side_residual\n";
     //}
 
-    // header: samplerate (32 bits), frames (32 bits), block_size (16 bits), channels (8 bits), predictor_order (8 bits), method (8 bits), use_dynamic_m (1 bit)
+    // header: samplerate (32 bits), frames (32 bits), block_size (16 bits), channels (8 bits), predictor_order (8 bits, order_auto for auto), method (8 bits), m mode (2 bits), [static m (32 bits)], zero bits up to a byte boundary
 
     obs.write_n_bits(static_cast<uint32_t>(sndFile.samplerate()), 32);
     obs.write_n_bits(static_cast<uint32_t>(sndFile.frames()), 32);
@@ -202,115 +602,62 @@ int main(int argc, char *argv[]) {
     obs.write_n_bits(static_cast<uint32_t>(channels), 8);
     obs.write_n_bits(static_cast<uint32_t>(predictor_order), 8);
     obs.write_n_bits(static_cast<uint32_t>(method), 8);
-    obs.write_n_bits(use_dynamic_m ? 1 : 0, 1);
+    MMode m_mode = use_coders ? M_CODER : use_adaptive ? M_ADAPTIVE : use_dynamic_m ? M_DYNAMIC : M_STATIC;
+    obs.write_n_bits(m_mode, 2);
 
-    if (!use_dynamic_m) {
+    if (m_mode == M_STATIC) {
         obs.write_n_bits(static_m_value, 32);
     }
-
-    vector<short> block_samples(BLOCK_SIZE * channels);
-    vector<int> mid(BLOCK_SIZE);
-    vector<int> side(BLOCK_SIZE);
-
-    //size_t block_num = 0;
-    size_t nFrames;
-    while ((nFrames = sndFile.readf(block_samples.data(), static_cast<int>(BLOCK_SIZE)))) {
-
-        if (channels == 1) {
-            // Mono use only mid
-            for (size_t i = 0; i < nFrames; ++i) {
-                mid[i] = static_cast<int>(block_samples[i]);
-                side[i] = 0; // not used for mono
-            }
-        } else {
-            // Stereo convert to mid/side
-            for (size_t i = 0; i < nFrames; ++i) {
-                int L = static_cast<int>(block_samples[i * channels + 0]);
-                int R = static_cast<int>(block_samples[i * channels + 1]);
-
-                // mid = (L + R) / 2 (integer division, truncates toward zero)
-                mid[i] = floor_div2(L + R);
-
-                // side = L - R
-                side[i] = L - R;
-            }
+    pad_to_byte(obs);
+
+    // Then a frame per block (see FRAME_SYNC): [mid order, side order
+    // (stereo)] if the order is auto (ORDER_BITS), [mid m, side m (stereo)] if
+    // dynamic (M_FIELD_CODE), the Golomb codes of the mid channel (warmup
+    // samples, then residuals) and, for stereo, those of the side channel. In
+    // adaptive mode each channel restarts from the initial statistics at
+    // every block. In coder mode each channel of the block is a coder field,
+    // then a Golomb m and codes or the block of another coder. Then the seek
+    // table (see SEEK_MAGIC).
+    EncoderSettings settings;
+    settings.channels = channels;
+    settings.predictor_order = predictor_order;
+    settings.method = method;
+    settings.m_mode = m_mode;
+    settings.rice_only = rice_only;
+    settings.static_m_value = static_m_value;
+
+    vector<uint64_t> frame_offsets;
+    if (threads > 1) {
+        encode_parallel(obs, sndFile, settings, coders, threads, frame_offsets);
+    } else {
+        BlockEncoder encoder(settings, coders);
+        vector<short> block_samples(BLOCK_SIZE * channels);
+
+        size_t nFrames;
+        while ((nFrames = sndFile.readf(block_samples.data(), static_cast<int>(BLOCK_SIZE)))) {
+            frame_offsets.push_back(obs.tell());
+            encode_frame(obs, encoder, settings, frame_offsets.size() - 1, block_samples.data(), nFrames);
         }
-
-        // Determine warmup size
-        size_t warmup = static_cast<size_t>(predictor_order);
-        if (warmup > nFrames) warmup = nFrames;
-
-        // Compute residuals for the block
-        vector<int> mid_residuals(nFrames - warmup);
-        vector<int> side_residuals(nFrames - warmup);
-
-        for (size_t i = warmup; i < nFrames; ++i) {
-            int predicted_mid = predict_from_order(mid, i, predictor_order);
-            mid_residuals[i - warmup] = mid[i] - predicted_mid;
-
-            if (channels == 2) {
-                int predicted_side = predict_from_order(side, i, predictor_order);
-                side_residuals[i - warmup] = side[i] - predicted_side;
-            }
-        }
-
-        uint32_t mid_m, side_m;
-        mid_m = static_m_value;
-        side_m = static_m_value;
-
-        if (use_dynamic_m) {
-            // Calculate optimal m values from residuals
-            double mid_mean = mean_abs(mid_residuals, nFrames - warmup);
-            double mid_alpha = mid_mean / (mid_mean + 1.0);
-            if (mid_alpha < 0.001) mid_alpha = 0.001;
-            if (mid_alpha > 0.999) mid_alpha = 0.999;
-            mid_m = ceil(-1 / log(mid_alpha));
-            if (mid_m < 1) mid_m = 1;
-
-            // write mid m
-            obs.write_n_bits(mid_m, 32);
-
-            if (channels == 2) {
-                double side_mean = mean_abs(side_residuals, nFrames - warmup);
-                double side_alpha = side_mean / (side_mean + 1.0);
-                if (side_alpha < 0.001) side_alpha = 0.001;
-                if (side_alpha > 0.999) side_alpha = 0.999;
-                side_m = ceil(-1 / log(side_alpha));
-                if (side_m < 1) side_m = 1;
-
-                // write side m
-                obs.write_n_bits(side_m, 32);
-            }
-        }
-
-        GolombUtils golomb_mid(mid_m, method);
-        GolombUtils golomb_side(side_m, method);
-
-        // Encode warmup samples directly
-        for (size_t i = 0; i < warmup; ++i) {
-            golomb_mid.golomb_encode(&obs, mid[i]);
-            if (channels == 2) {
-                golomb_side.golomb_encode(&obs, side[i]);
-            }
-        }
-
-        // Encode residuals
-        for (size_t i = 0; i < nFrames - warmup; ++i) {
-            golomb_mid.golomb_encode(&obs, mid_residuals[i]);
-
-            if (channels == 2) {
-                golomb_side.golomb_encode(&obs, side_residuals[i]);
-            }
-
-            // Debug: write residuals
-            //if (debug_file.is_open()) {
-            //    debug_file << block_num << "," << i << "," << residual_mid << "," << residual_side << "\n";
-            //}
-        }
-        //block_num++;
     }
 
-    obs.close();
+    // Seek table, with offsets as wide as the largest one needs
+    uint64_t table_offset = obs.tell();
+    int offset_bytes = max(1, (64 - __builtin_clzll(table_offset) + 7) / 8);
+    for (size_t frame = 0; frame < frame_offsets.size(); frame++) {
+        obs.write_n_bits(frame_offsets[frame], 8 * offset_bytes);
+        obs.write_n_bits(frame * BLOCK_SIZE, 32);
+    }
+    obs.write_n_bits(table_offset, 64);
+    obs.write_n_bits(frame_offsets.size(), 32);
+    obs.write_n_bits(offset_bytes, 8);
+    obs.write_n_bits(SEEK_MAGIC, 32);
+
+    try {
+        obs.close();
+    } catch (const exception &e) {
+        cerr << "Error: " << e.what() << "\n";
+        return 1;
+    }
     ofs.close();
 
     //if (debug_file.is_open()) {
@@ -0,0 +1,43 @@
+#!/bin/bash
+
+# Encoder throughput: runs wav_lossless_enc on every sample and reports
+# MB/s of input WAV data. Extra arguments are passed to the encoder.
+#
+# Usage: ./bench_wav_lossless_enc.sh [encoder flags]
+# Set RUNS to change the number of repetitions (default: 5).
+
+WAV_ENC="../bin/wav_lossless_enc"
+RUNS=${RUNS:-5}
+OUT_BIN="bench_enc.bin"
+
+if [ ! -x "$WAV_ENC" ]; then
+    echo "Error: $WAV_ENC not found or not executable"
+    exit 1
+fi
+
+echo "file,bytes,best_ms,mb_per_s"
+
+total_bytes=0
+total_ns=0
+for WAV in sample*.wav; do
+    bytes=$(stat -c %s "$WAV")
+    best=0
+    for ((r = 0; r < RUNS; r++)); do
+        t0=$(date +%s%N)
+        "$WAV_ENC" "$WAV" "$OUT_BIN" "$@" > /dev/null || exit 1
+        t1=$(date +%s%N)
+        dt=$((t1 - t0))
+        if [ $best -eq 0 ] || [ $dt -lt $best ]; then
+            best=$dt
+        fi
+    done
+    total_bytes=$((total_bytes + bytes))
+    total_ns=$((total_ns + best))
+    awk -v f="$WAV" -v b="$bytes" -v ns="$best" \
+        'BEGIN { printf "%s,%d,%.2f,%.2f\n", f, b, ns / 1e6, (b / 1e6) / (ns / 1e9) }'
+done
+
+awk -v b="$total_bytes" -v ns="$total_ns" \
+    'BEGIN { printf "total,%d,%.2f,%.2f\n", b, ns / 1e6, (b / 1e6) / (ns / 1e9) }'
+
+rm -f "$OUT_BIN"